@@ -1,124 +1,2773 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-#define MAX_NUMBERS 20
-#define PHONE_LENGTH 5  // "0781\0"
+#define PHONE_LENGTH 20         // "+250781234567\0" plus room for longer input
+#define MAX_DIGITS 15           // E.164 limit
+#define MATRIX_PRINT_LIMIT 32   // Larger graphs skip the O(V^2) matrix dump
+#define NO_NODE UINT32_MAX
+#define MAX_THREADS 64
+#define INGEST_BLOCK_SIZE (64 << 20)    // stdin is read in blocks of this many bytes
+#define MAX_HOPS 16
+#define HOP_PRINT_LIMIT 20      // Numbers listed per hop level
+#define BFS_ALPHA 14            // Direction-optimizing BFS switch thresholds (Beamer et al.)
+#define BFS_BETA 24
+#define LOUVAIN_MAX_PASSES 20   // Local-moving passes per Louvain level
+#define PAGERANK_DAMPING 0.85
+#define PAGERANK_MAX_ITERATIONS 50
+#define PAGERANK_TOLERANCE 1e-6 // Stop once the L1 change per iteration falls below this
+#define TOP_RANKED 10
+#define ANALYSIS_MAGIC 0x4E414446   // "FDAN"
+#define ANALYSIS_RECORD_SIZE 24
+#define GALLOP_RATIO 32         // Gallop when one list is this many times longer
+#define TRIANGLE_CHUNK 1024     // Nodes claimed per work request in triangle counting
+#define SECONDS_PER_DAY 86400
+#define DEFAULT_BUCKET_HOURS 24 // Width of one time bucket in windowed mode
+
+// Phone numbers are packed into 64 bits so leading zeros and a '+' prefix survive:
+// bit 63 = '+', bits 56-59 = digit count, bits 0-49 = numeric value (15 digits < 2^50)
+typedef uint64_t PhoneKey;
+typedef uint32_t NodeId;
+
+typedef struct {
+    NodeId from;
+    NodeId to;
+} EdgePair;
+
+// Hash index slot; the key is stored inline so probes touch one cache line
+typedef struct {
+    PhoneKey key;
+    NodeId id;              // NO_NODE when the slot is empty
+} IndexSlot;
+
+// Calls between two nodes within one bucket; a single call has
+// first_seen == last_seen and calls == 1
+typedef struct {
+    NodeId from;
+    NodeId to;
+    int64_t first_seen;
+    int64_t last_seen;
+    uint32_t calls;
+} TimedContact;
+
+// Contacts seen during one time bucket, as a CSR over just the nodes that
+// called in it. Every entry carries the first and last call time within the
+// bucket and a call count.
+typedef struct {
+    int64_t start;          // Covers [start, start + bucket_seconds)
+    NodeId* nodes;          // Sorted nodes with contacts in this bucket
+    NodeId node_count;
+    uint64_t* offsets;      // Indexed by position in nodes
+    NodeId* neighbors;
+    int64_t* first_seen;
+    int64_t* last_seen;
+    uint32_t* calls;
+    uint64_t entries;
+    TimedContact* pending;  // Calls not yet merged into the CSR
+    uint64_t pending_count;
+    uint64_t pending_capacity;
+} Segment;
+
+// Sliding window of time-bucketed segments, oldest first. Whole segments
+// are dropped as the window moves, so expiry never touches the newer ones.
+typedef struct {
+    int enabled;
+    int64_t bucket_seconds;
+    int64_t retention;      // Seconds kept behind the newest call, 0 = keep all
+    Segment** segments;
+    int count;
+    int capacity;
+    int64_t newest;         // Latest call time seen
+    uint64_t expired_calls; // Calls that arrived already outside the window
+    uint64_t expired_segments;
+    int64_t query_from;     // Time range applied to queries
+    int64_t query_to;
+} TimeWindow;
 
 typedef struct {
-    char numbers[MAX_NUMBERS][PHONE_LENGTH];
-    int adjacency[MAX_NUMBERS][MAX_NUMBERS];
-    int size;
+    PhoneKey* numbers;      // NodeId -> phone number
+    NodeId size;
+    NodeId capacity;
+
+    IndexSlot* index;       // Open-addressed hash index, linear probing
+    uint64_t index_capacity;    // Power of two, kept at most half full
+
+    // CSR adjacency: neighbours of v are neighbors[offsets[v] .. offsets[v + 1]), sorted.
+    // When packed is set the lists are compressed instead, neighbors is NULL and
+    // offsets[v] is the byte position of v's list in packed.
+    uint64_t* offsets;
+    NodeId* neighbors;
+    uint8_t* packed;
+    NodeId csr_size;        // Nodes covered by offsets
+    uint64_t entries;       // Neighbour entries in the built graph (twice the contacts)
+    int compress;           // Keep the lists compressed across rebuilds
+
+    EdgePair* pending;      // Connections added since the last build_graph
+    uint64_t pending_count;
+    uint64_t pending_capacity;
+
+    TimeWindow window;      // Windowed mode: contacts live in segments, not the CSR above
 } Graph;
 
+int thread_count = 1;   // Worker threads for ingestion and graph building
+
 // Initialize graph
 void init_graph(Graph* g) {
-    g->size = 0;
-    memset(g->adjacency, 0, sizeof(g->adjacency));
+    memset(g, 0, sizeof(*g));
+    g->window.bucket_seconds = DEFAULT_BUCKET_HOURS * 3600;
+    g->window.query_from = INT64_MIN;
+    g->window.query_to = INT64_MAX;
+}
+
+void free_segment(Segment* seg) {
+    free(seg->nodes);
+    free(seg->offsets);
+    free(seg->neighbors);
+    free(seg->first_seen);
+    free(seg->last_seen);
+    free(seg->calls);
+    free(seg->pending);
+    free(seg);
+}
+
+void free_window(TimeWindow* w) {
+    for (int i = 0; i < w->count; i++) free_segment(w->segments[i]);
+    free(w->segments);
+    w->segments = NULL;
+    w->count = w->capacity = 0;
+}
+
+void free_graph(Graph* g) {
+    free_window(&g->window);
+    free(g->numbers);
+    free(g->index);
+    free(g->offsets);
+    free(g->neighbors);
+    free(g->packed);
+    free(g->pending);
+    init_graph(g);
+}
+
+// Parse "+250781234567" or "0781" into a key, returns 0 if not a valid number
+PhoneKey encode_number(const char* number) {
+    PhoneKey plus = 0, value = 0;
+    int digits = 0;
+
+    if (*number == '+') {
+        plus = 1;
+        number++;
+    }
+    for (; *number; number++) {
+        if (*number < '0' || *number > '9' || digits == MAX_DIGITS) return 0;
+        value = value * 10 + (*number - '0');
+        digits++;
+    }
+    if (digits == 0) return 0;
+    return (plus << 63) | ((PhoneKey)digits << 56) | value;
+}
+
+// Write the number back in its original form, out must hold PHONE_LENGTH chars
+void format_number(PhoneKey key, char* out) {
+    int digits = (int)((key >> 56) & 0xF);
+    unsigned long long value = key & ((1ULL << 50) - 1);
+    snprintf(out, PHONE_LENGTH, "%s%0*llu", (key >> 63) ? "+" : "", digits, value);
+}
+
+uint64_t hash_key(PhoneKey key) {
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+// Find ID of a phone number key, return NO_NODE if not found
+NodeId find_key(Graph* g, PhoneKey key) {
+    if (!g->index_capacity) return NO_NODE;
+
+    uint64_t mask = g->index_capacity - 1;
+    for (uint64_t slot = hash_key(key) & mask; g->index[slot].id != NO_NODE; slot = (slot + 1) & mask) {
+        if (g->index[slot].key == key) {
+            return g->index[slot].id;
+        }
+    }
+    return NO_NODE;
+}
+
+// Find ID of a phone number, return NO_NODE if not found
+NodeId find_number(Graph* g, const char* number) {
+    PhoneKey key = encode_number(number);
+    return key ? find_key(g, key) : NO_NODE;
+}
+
+// Insert IDs 0..size-1 into an empty hash index of the given capacity
+void fill_index(IndexSlot* index, uint64_t capacity, const PhoneKey* numbers, NodeId size) {
+    for (uint64_t slot = 0; slot < capacity; slot++) index[slot].id = NO_NODE;
+    for (NodeId id = 0; id < size; id++) {
+        uint64_t slot = hash_key(numbers[id]) & (capacity - 1);
+        while (index[slot].id != NO_NODE) slot = (slot + 1) & (capacity - 1);
+        index[slot].key = numbers[id];
+        index[slot].id = id;
+    }
+}
+
+// Double the hash index and reinsert every ID
+int grow_index(Graph* g) {
+    uint64_t capacity = g->index_capacity ? g->index_capacity * 2 : 64;
+    IndexSlot* index = (IndexSlot*)malloc(capacity * sizeof(IndexSlot));
+    if (!index) return 0;
+    fill_index(index, capacity, g->numbers, g->size);
+
+    free(g->index);
+    g->index = index;
+    g->index_capacity = capacity;
+    return 1;
 }
 
-// Find index of a phone number, return -1 if not found
-int find_number(Graph* g, const char* number) {
-    for (int i = 0; i < g->size; i++) {
-        if (strcmp(g->numbers[i], number) == 0) {
-            return i;
+// Add a phone number key to the graph, returns its ID
+NodeId add_key(Graph* g, PhoneKey key) {
+    NodeId id = find_key(g, key);
+    if (id != NO_NODE) return id;
+
+    if (g->size == NO_NODE - 1) {
+        printf("Error: Maximum number of nodes reached\n");
+        return NO_NODE;
+    }
+    if (g->size == g->capacity) {
+        NodeId capacity = g->capacity ? g->capacity * 2 : 64;
+        if (capacity < g->capacity) capacity = NO_NODE - 1;
+        PhoneKey* numbers = (PhoneKey*)realloc(g->numbers, (size_t)capacity * sizeof(PhoneKey));
+        if (!numbers) {
+            printf("Error: Out of memory\n");
+            return NO_NODE;
         }
+        g->numbers = numbers;
+        g->capacity = capacity;
     }
-    return -1;
+    if (2 * ((uint64_t)g->size + 1) > g->index_capacity && !grow_index(g)) {
+        printf("Error: Out of memory\n");
+        return NO_NODE;
+    }
+
+    id = g->size++;
+    g->numbers[id] = key;
+    uint64_t mask = g->index_capacity - 1;
+    uint64_t slot = hash_key(key) & mask;
+    while (g->index[slot].id != NO_NODE) slot = (slot + 1) & mask;
+    g->index[slot].key = key;
+    g->index[slot].id = id;
+    return id;
 }
 
 // Add new phone number to graph
-int add_number(Graph* g, const char* number) {
-    int idx = find_number(g, number);
-    if (idx == -1) {
-        if (g->size >= MAX_NUMBERS) {
-            printf("Error: Maximum number of nodes reached\n");
-            return -1;
+NodeId add_number(Graph* g, const char* number) {
+    PhoneKey key = encode_number(number);
+    if (!key) {
+        printf("Error: Invalid phone number %s\n", number);
+        return NO_NODE;
+    }
+    return add_key(g, key);
+}
+
+// Queue an undirected edge, picked up by the next build_graph
+int add_edge(Graph* g, NodeId from, NodeId to) {
+    if (from == to) return 1;
+    if (g->pending_count == g->pending_capacity) {
+        uint64_t capacity = g->pending_capacity ? g->pending_capacity * 2 : 64;
+        EdgePair* pending = (EdgePair*)realloc(g->pending, capacity * sizeof(EdgePair));
+        if (!pending) {
+            printf("Error: Out of memory\n");
+            return 0;
         }
-        strcpy(g->numbers[g->size], number);
-        idx = g->size;
-        g->size++;
+        g->pending = pending;
+        g->pending_capacity = capacity;
     }
-    return idx;
+    g->pending[g->pending_count].from = from;
+    g->pending[g->pending_count].to = to;
+    g->pending_count++;
+    return 1;
 }
 
 // Add connection between two numbers
 void add_connection(Graph* g, const char* from, const char* to) {
-    int from_idx = add_number(g, from);
-    int to_idx = add_number(g, to);
-    
-    if (from_idx != -1 && to_idx != -1) {
-        g->adjacency[from_idx][to_idx] = 1;
-        g->adjacency[to_idx][from_idx] = 1;  // Undirected graph
+    NodeId from_idx = add_number(g, from);
+    NodeId to_idx = add_number(g, to);
+
+    if (from_idx != NO_NODE && to_idx != NO_NODE) {
+        add_edge(g, from_idx, to_idx);  // Undirected graph
+    }
+}
+
+int compare_node(const void* a, const void* b) {
+    NodeId x = *(const NodeId*)a, y = *(const NodeId*)b;
+    return (x > y) - (x < y);
+}
+
+// Run fn over count task structs of task_size bytes, one thread each.
+// Task 0 runs on the calling thread.
+void run_parallel(void* (*fn)(void*), void* tasks, size_t task_size, int count) {
+    pthread_t threads[MAX_THREADS];
+    int started[MAX_THREADS] = {0};
+
+    for (int t = 1; t < count; t++) {
+        started[t] = pthread_create(&threads[t], NULL, fn, (char*)tasks + t * task_size) == 0;
+        if (!started[t]) fn((char*)tasks + t * task_size);
+    }
+    fn(tasks);
+    for (int t = 1; t < count; t++) {
+        if (started[t]) pthread_join(threads[t], NULL);
+    }
+}
+
+// ---- Compressed adjacency ----
+// A packed list is a varint degree followed by varint gaps: the first
+// neighbour's ID, then the difference to each previous neighbour.
+
+uint8_t* put_varint(uint8_t* out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+uint64_t get_varint(const uint8_t** in) {
+    const uint8_t* p = *in;
+    uint64_t value = *p & 0x7F;
+    int shift = 7;
+    while (*p++ & 0x80) {
+        value |= (uint64_t)(*p & 0x7F) << shift;
+        shift += 7;
+    }
+    *in = p;
+    return value;
+}
+
+int varint_size(uint64_t value) {
+    int size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+// Walks one neighbour list in either storage format, or across the
+// segments of a time window
+typedef struct {
+    const NodeId* list;     // Uncompressed position, NULL when packed
+    const uint8_t* bytes;   // Packed position
+    uint64_t remaining;
+    NodeId last;
+    // Windowed mode only
+    TimeWindow* window;     // NULL for the plain CSR
+    NodeId node;
+    int segment;
+    uint64_t position;
+    uint32_t calls;         // Calls and last time of the entry just returned
+    int64_t last_seen;
+} NeighborCursor;
+
+// A segment is worth visiting if its bucket overlaps the query range
+int segment_in_range(TimeWindow* w, Segment* seg) {
+    return seg->start <= w->query_to && seg->start + w->bucket_seconds > w->query_from;
+}
+
+// Position of v in a segment's node list, or -1 if it made no calls there
+int64_t segment_slot(Segment* seg, NodeId v) {
+    NodeId lo = 0, hi = seg->node_count;
+    while (lo < hi) {
+        NodeId mid = lo + (hi - lo) / 2;
+        if (seg->nodes[mid] < v) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < seg->node_count && seg->nodes[lo] == v ? (int64_t)lo : -1;
+}
+
+// Move the cursor to v's list in the next in-range segment at or after index
+int open_segment(NeighborCursor* c, int index) {
+    TimeWindow* w = c->window;
+    for (c->segment = index; c->segment < w->count; c->segment++) {
+        Segment* seg = w->segments[c->segment];
+        int64_t slot = segment_in_range(w, seg) ? segment_slot(seg, c->node) : -1;
+        if (slot >= 0) {
+            c->position = seg->offsets[slot];
+            c->remaining = seg->offsets[slot + 1] - c->position;
+            return 1;
+        }
+    }
+    c->remaining = 0;
+    return 0;
+}
+
+// Windowed step: skip entries whose calls all fall outside the query range.
+// A neighbour seen in several buckets is returned once per bucket.
+int next_window_neighbor(NeighborCursor* c, NodeId* out) {
+    TimeWindow* w = c->window;
+    while (1) {
+        Segment* seg = c->segment < w->count ? w->segments[c->segment] : NULL;
+        while (c->remaining) {
+            uint64_t e = c->position++;
+            c->remaining--;
+            if (seg->first_seen[e] <= w->query_to && seg->last_seen[e] >= w->query_from) {
+                *out = seg->neighbors[e];
+                c->calls = seg->calls[e];
+                c->last_seen = seg->last_seen[e];
+                return 1;
+            }
+        }
+        if (!seg || !open_segment(c, c->segment + 1)) return 0;
+    }
+}
+
+void open_neighbors(Graph* g, NodeId v, NeighborCursor* c) {
+    c->list = NULL;
+    c->bytes = NULL;
+    c->remaining = 0;
+    c->last = 0;
+    c->window = NULL;
+    if (g->window.enabled) {
+        c->window = &g->window;
+        c->node = v;
+        open_segment(c, 0);
+        return;
+    }
+    if (v >= g->csr_size) return;
+    if (g->packed) {
+        c->bytes = g->packed + g->offsets[v];
+        c->remaining = get_varint(&c->bytes);
+    } else {
+        c->list = &g->neighbors[g->offsets[v]];
+        c->remaining = g->offsets[v + 1] - g->offsets[v];
+    }
+}
+
+// Fetch the next neighbour in ascending order, decoding on the fly
+int next_neighbor(NeighborCursor* c, NodeId* out) {
+    if (c->window) return next_window_neighbor(c, out);
+    if (c->remaining == 0) return 0;
+    c->remaining--;
+    if (c->list) {
+        *out = *c->list++;
+    } else {
+        c->last += (NodeId)get_varint(&c->bytes);
+        *out = c->last;
+    }
+    return 1;
+}
+
+// Number of neighbours of v in the built graph. In windowed mode this is an
+// upper bound: entries summed over in-range segments, before time filtering.
+uint64_t degree(Graph* g, NodeId v) {
+    if (g->window.enabled) {
+        TimeWindow* w = &g->window;
+        uint64_t total = 0;
+        for (int i = 0; i < w->count; i++) {
+            Segment* seg = w->segments[i];
+            int64_t slot = segment_in_range(w, seg) ? segment_slot(seg, v) : -1;
+            if (slot >= 0) total += seg->offsets[slot + 1] - seg->offsets[slot];
+        }
+        return total;
+    }
+    if (v >= g->csr_size) return 0;
+    if (g->packed) {
+        const uint8_t* p = g->packed + g->offsets[v];
+        return get_varint(&p);
+    }
+    return g->offsets[v + 1] - g->offsets[v];
+}
+
+// Neighbour entries in the built graph, counted the same way as degree():
+// in windowed mode, summed over the in-range segments
+uint64_t total_entries(Graph* g) {
+    if (!g->window.enabled) return g->entries;
+    TimeWindow* w = &g->window;
+    uint64_t total = 0;
+    for (int i = 0; i < w->count; i++) {
+        if (segment_in_range(w, w->segments[i])) total += w->segments[i]->entries;
+    }
+    return total;
+}
+
+// Sort a neighbour list: insertion sort for the short lists most nodes have
+void sort_nodes(NodeId* list, uint64_t count) {
+    if (count > 32) {
+        qsort(list, count, sizeof(NodeId), compare_node);
+        return;
+    }
+    for (uint64_t i = 1; i < count; i++) {
+        NodeId v = list[i];
+        uint64_t j = i;
+        while (j > 0 && list[j - 1] > v) {
+            list[j] = list[j - 1];
+            j--;
+        }
+        list[j] = v;
+    }
+}
+
+// Return v's sorted, duplicate-free neighbour list: a direct pointer for the
+// plain CSR, otherwise decoded into scratch (which must hold degree(g, v)
+// entries). *count receives the list length.
+const NodeId* neighbor_list(Graph* g, NodeId v, NodeId* scratch, uint64_t* count) {
+    if (!g->packed && !g->window.enabled) {
+        *count = degree(g, v);
+        return v < g->csr_size ? &g->neighbors[g->offsets[v]] : scratch;
+    }
+    NeighborCursor c;
+    uint64_t n = 0;
+    for (open_neighbors(g, v, &c); next_neighbor(&c, &scratch[n]); n++) {}
+    if (g->window.enabled) {
+        // Segments are visited in turn, so merge their lists
+        sort_nodes(scratch, n);
+        uint64_t out = 0;
+        for (uint64_t i = 0; i < n; i++) {
+            if (i == 0 || scratch[i] != scratch[i - 1]) scratch[out++] = scratch[i];
+        }
+        n = out;
+    }
+    *count = n;
+    return scratch;
+}
+
+typedef struct {
+    NodeId* neighbors;
+    const uint64_t* offsets;
+    NodeId* unique;         // Per-node count after deduplication
+    NodeId first;
+    NodeId last;
+    uint64_t end;           // One past the last compacted neighbour
+} SortTask;
+
+// Sort and deduplicate the lists of nodes [first, last), compacting them
+// towards offsets[first]
+void* sort_lists_worker(void* arg) {
+    SortTask* task = (SortTask*)arg;
+    NodeId* neighbors = task->neighbors;
+    uint64_t out = task->offsets[task->first];
+
+    for (NodeId v = task->first; v < task->last; v++) {
+        uint64_t begin = task->offsets[v], end = task->offsets[v + 1];
+        uint64_t start = out;
+        sort_nodes(&neighbors[begin], end - begin);
+        for (uint64_t i = begin; i < end; i++) {
+            if (i == begin || neighbors[i] != neighbors[i - 1]) {
+                neighbors[out++] = neighbors[i];
+            }
+        }
+        task->unique[v] = (NodeId)(out - start);
+    }
+    task->end = out;
+    return NULL;
+}
+
+// First node whose list starts at or after the given neighbour position
+NodeId node_at(const uint64_t* offsets, NodeId n, uint64_t position) {
+    NodeId lo = 0, hi = n;
+    while (lo < hi) {
+        NodeId mid = lo + (hi - lo) / 2;
+        if (offsets[mid] < position) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Expand packed lists back into plain CSR arrays
+int unpack_graph(Graph* g) {
+    NodeId n = g->csr_size;
+    uint64_t* offsets = (uint64_t*)malloc(((size_t)n + 1) * sizeof(uint64_t));
+    NodeId* neighbors = (NodeId*)malloc((g->entries + 1) * sizeof(NodeId));
+    if (!offsets || !neighbors) {
+        printf("Error: Out of memory\n");
+        free(offsets);
+        free(neighbors);
+        return 0;
+    }
+
+    uint64_t out = 0;
+    for (NodeId v = 0; v < n; v++) {
+        NeighborCursor c;
+        offsets[v] = out;
+        for (open_neighbors(g, v, &c); next_neighbor(&c, &neighbors[out]); out++) {}
     }
+    offsets[n] = out;
+
+    free(g->offsets);
+    free(g->packed);
+    g->offsets = offsets;
+    g->neighbors = neighbors;
+    g->packed = NULL;
+    return 1;
+}
+
+// Relabel nodes in BFS order so that contacts get nearby IDs and the gaps
+// in each list stay small. Numbers, the hash index and lists are all remapped.
+// Everything is allocated up front, so on failure the graph is unchanged.
+// Returns 1 on success, 0 when out of memory and -1 if the graph is not built.
+int reorder_graph(Graph* g) {
+    NodeId n = g->csr_size;
+    if (n != g->size) return -1;
+    NodeId* order = (NodeId*)malloc(((size_t)n + 1) * sizeof(NodeId));
+    NodeId* rename = (NodeId*)malloc(((size_t)n + 1) * sizeof(NodeId));
+    PhoneKey* numbers = (PhoneKey*)malloc(((size_t)g->capacity + 1) * sizeof(PhoneKey));
+    uint64_t* offsets = (uint64_t*)malloc(((size_t)n + 1) * sizeof(uint64_t));
+    NodeId* neighbors = (NodeId*)malloc((g->entries + 1) * sizeof(NodeId));
+    IndexSlot* index = (IndexSlot*)malloc(g->index_capacity * sizeof(IndexSlot));
+    if (!order || !rename || !numbers || !offsets || !neighbors || !index) {
+        free(order);
+        free(rename);
+        free(numbers);
+        free(offsets);
+        free(neighbors);
+        free(index);
+        return 0;
+    }
+
+    NodeId placed = 0;
+    for (NodeId v = 0; v < n; v++) rename[v] = NO_NODE;
+    for (NodeId root = 0; root < n; root++) {
+        if (rename[root] != NO_NODE) continue;
+        NodeId head = placed;
+        rename[root] = placed;
+        order[placed++] = root;
+        while (head < placed) {
+            NodeId u = order[head++];
+            for (uint64_t e = g->offsets[u]; e < g->offsets[u + 1]; e++) {
+                NodeId v = g->neighbors[e];
+                if (rename[v] == NO_NODE) {
+                    rename[v] = placed;
+                    order[placed++] = v;
+                }
+            }
+        }
+    }
+
+    uint64_t out = 0;
+    for (NodeId i = 0; i < n; i++) {
+        NodeId old = order[i];
+        numbers[i] = g->numbers[old];
+        offsets[i] = out;
+        for (uint64_t e = g->offsets[old]; e < g->offsets[old + 1]; e++) {
+            neighbors[out++] = rename[g->neighbors[e]];
+        }
+        sort_nodes(&neighbors[offsets[i]], out - offsets[i]);
+    }
+    offsets[n] = out;
+    fill_index(index, g->index_capacity, numbers, n);
+
+    free(g->numbers);
+    free(g->offsets);
+    free(g->neighbors);
+    free(g->index);
+    g->numbers = numbers;
+    g->capacity = n + 1;
+    g->offsets = offsets;
+    g->neighbors = neighbors;
+    g->index = index;
+    free(order);
+    free(rename);
+    return 1;
+}
+
+// Replace the CSR arrays with delta + varint packed lists, relabelling
+// nodes first for locality. Prints the memory saved.
+int compress_graph(Graph* g) {
+    if (g->packed) return 1;
+    int reordered = reorder_graph(g);
+    if (reordered < 0) {
+        printf("Error: Graph has numbers not yet built into the adjacency, cannot compress\n");
+        return 0;
+    }
+    if (!reordered) {
+        printf("Error: Out of memory while compressing\n");
+        return 0;
+    }
+
+    NodeId n = g->csr_size;
+    uint64_t bytes = 0;
+    for (NodeId v = 0; v < n; v++) {
+        NodeId last = 0;
+        bytes += varint_size(g->offsets[v + 1] - g->offsets[v]);
+        for (uint64_t e = g->offsets[v]; e < g->offsets[v + 1]; e++) {
+            bytes += varint_size(g->neighbors[e] - last);
+            last = g->neighbors[e];
+        }
+    }
+
+    uint8_t* packed = (uint8_t*)malloc(bytes + 1);
+    if (!packed) {
+        printf("Error: Out of memory while compressing\n");
+        return 0;
+    }
+
+    uint8_t* out = packed;
+    for (NodeId v = 0; v < n; v++) {
+        uint64_t begin = g->offsets[v], end = g->offsets[v + 1];
+        NodeId last = 0;
+        g->offsets[v] = out - packed;
+        out = put_varint(out, end - begin);
+        for (uint64_t e = begin; e < end; e++) {
+            out = put_varint(out, g->neighbors[e] - last);
+            last = g->neighbors[e];
+        }
+    }
+    g->offsets[n] = out - packed;
+
+    printf("Adjacency compressed: %.1f MB -> %.1f MB (%.2fx)\n",
+           g->entries * sizeof(NodeId) / 1048576.0, bytes / 1048576.0,
+           bytes ? (double)g->entries * sizeof(NodeId) / bytes : 0.0);
+    free(g->neighbors);
+    g->neighbors = NULL;
+    g->packed = packed;
+    return 1;
+}
+
+// LSD radix sort of contacts by (from, to) on 16-bit digits
+void sort_contacts(TimedContact* data, TimedContact* scratch, uint64_t count) {
+    NodeId max = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        if (data[i].from > max) max = data[i].from;
+        if (data[i].to > max) max = data[i].to;
+    }
+
+    for (int pass = 0; pass < 4; pass++) {
+        int shift = (pass & 1) * 16;
+        if (shift && !(max >> 16)) continue;
+        uint64_t buckets[65537] = {0};
+        for (uint64_t i = 0; i < count; i++) {
+            NodeId key = pass < 2 ? data[i].to : data[i].from;
+            buckets[((key >> shift) & 0xFFFF) + 1]++;
+        }
+        for (int b = 0; b < 65536; b++) buckets[b + 1] += buckets[b];
+        for (uint64_t i = 0; i < count; i++) {
+            NodeId key = pass < 2 ? data[i].to : data[i].from;
+            scratch[buckets[(key >> shift) & 0xFFFF]++] = data[i];
+        }
+        memcpy(data, scratch, count * sizeof(TimedContact));
+    }
+}
+
+// Sort contacts and fold repeated (from, to) pairs together; returns the new count
+uint64_t merge_contacts(TimedContact* data, TimedContact* scratch, uint64_t count) {
+    sort_contacts(data, scratch, count);
+    uint64_t out = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        TimedContact* last = out ? &data[out - 1] : NULL;
+        if (last && last->from == data[i].from && last->to == data[i].to) {
+            if (data[i].first_seen < last->first_seen) last->first_seen = data[i].first_seen;
+            if (data[i].last_seen > last->last_seen) last->last_seen = data[i].last_seen;
+            last->calls += data[i].calls;
+        } else {
+            data[out++] = data[i];
+        }
+    }
+    return out;
+}
+
+// Merge a segment's pending calls into its CSR: fold each pair's calls into
+// one contact, then lay the contacts out in both directions. Every neighbour
+// list comes out sorted because contacts are emitted in (from, to) order.
+int build_segment(Segment* seg) {
+    uint64_t count = seg->entries / 2 + seg->pending_count;
+    TimedContact* contacts = (TimedContact*)malloc((2 * count + 1) * sizeof(TimedContact));
+    TimedContact* scratch = (TimedContact*)malloc((2 * count + 1) * sizeof(TimedContact));
+    if (!contacts || !scratch) {
+        free(contacts);
+        free(scratch);
+        return 0;
+    }
+
+    // Existing contacts once each (from < to), then the new calls
+    uint64_t n = 0;
+    for (NodeId i = 0; i < seg->node_count; i++) {
+        for (uint64_t e = seg->offsets[i]; e < seg->offsets[i + 1]; e++) {
+            if (seg->neighbors[e] < seg->nodes[i]) continue;
+            contacts[n].from = seg->nodes[i];
+            contacts[n].to = seg->neighbors[e];
+            contacts[n].first_seen = seg->first_seen[e];
+            contacts[n].last_seen = seg->last_seen[e];
+            contacts[n].calls = seg->calls[e];
+            n++;
+        }
+    }
+    memcpy(&contacts[n], seg->pending, seg->pending_count * sizeof(TimedContact));
+    n = merge_contacts(contacts, scratch, n + seg->pending_count);
+
+    // Mirror every contact and sort again to group entries by node
+    for (uint64_t i = 0; i < n; i++) {
+        contacts[n + i] = contacts[i];
+        contacts[n + i].from = contacts[i].to;
+        contacts[n + i].to = contacts[i].from;
+    }
+    n *= 2;
+    sort_contacts(contacts, scratch, n);
+    free(scratch);
+
+    NodeId node_count = 0;
+    for (uint64_t i = 0; i < n; i++) node_count += i == 0 || contacts[i].from != contacts[i - 1].from;
+    NodeId* nodes = (NodeId*)malloc(((size_t)node_count + 1) * sizeof(NodeId));
+    uint64_t* offsets = (uint64_t*)malloc(((size_t)node_count + 1) * sizeof(uint64_t));
+    NodeId* neighbors = (NodeId*)malloc((n + 1) * sizeof(NodeId));
+    int64_t* first_seen = (int64_t*)malloc((n + 1) * sizeof(int64_t));
+    int64_t* last_seen = (int64_t*)malloc((n + 1) * sizeof(int64_t));
+    uint32_t* calls = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+    if (!nodes || !offsets || !neighbors || !first_seen || !last_seen || !calls) {
+        free(contacts);
+        free(nodes);
+        free(offsets);
+        free(neighbors);
+        free(first_seen);
+        free(last_seen);
+        free(calls);
+        return 0;
+    }
+
+    NodeId slot = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        if (i == 0 || contacts[i].from != contacts[i - 1].from) {
+            nodes[slot] = contacts[i].from;
+            offsets[slot++] = i;
+        }
+        neighbors[i] = contacts[i].to;
+        first_seen[i] = contacts[i].first_seen;
+        last_seen[i] = contacts[i].last_seen;
+        calls[i] = contacts[i].calls;
+    }
+    offsets[node_count] = n;
+    free(contacts);
+
+    free(seg->nodes);
+    free(seg->offsets);
+    free(seg->neighbors);
+    free(seg->first_seen);
+    free(seg->last_seen);
+    free(seg->calls);
+    seg->nodes = nodes;
+    seg->node_count = node_count;
+    seg->offsets = offsets;
+    seg->neighbors = neighbors;
+    seg->first_seen = first_seen;
+    seg->last_seen = last_seen;
+    seg->calls = calls;
+    seg->entries = n;
+    seg->pending_count = 0;
+    return 1;
+}
+
+typedef struct {
+    TimeWindow* window;
+    int first;              // Segments first, first + step, ...
+    int step;
+    int failed;
+} SegmentTask;
+
+void* segment_worker(void* arg) {
+    SegmentTask* task = (SegmentTask*)arg;
+    task->failed = 0;
+    for (int i = task->first; i < task->window->count; i += task->step) {
+        Segment* seg = task->window->segments[i];
+        if (seg->pending_count && !build_segment(seg)) task->failed = 1;
+    }
+    return NULL;
+}
+
+// Build every segment that received calls since the last build, in parallel.
+// Untouched segments are left as they are.
+int build_window(TimeWindow* w) {
+    int dirty = 0;
+    for (int i = 0; i < w->count; i++) dirty += w->segments[i]->pending_count > 0;
+    if (!dirty) return 1;
+
+    SegmentTask tasks[MAX_THREADS];
+    int count = thread_count < dirty ? thread_count : dirty;
+    for (int t = 0; t < count; t++) {
+        tasks[t].window = w;
+        tasks[t].first = t;
+        tasks[t].step = count;
+    }
+    run_parallel(segment_worker, tasks, sizeof(SegmentTask), count);
+    for (int t = 0; t < count; t++) {
+        if (tasks[t].failed) {
+            printf("Error: Out of memory\n");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Drop whole segments that ended before the retention span
+void expire_segments(TimeWindow* w) {
+    if (!w->retention) return;
+    int drop = 0;
+    while (drop < w->count && w->segments[drop]->start + w->bucket_seconds <= w->newest - w->retention) {
+        free_segment(w->segments[drop++]);
+    }
+    if (!drop) return;
+    memmove(w->segments, w->segments + drop, (w->count - drop) * sizeof(Segment*));
+    w->count -= drop;
+    w->expired_segments += drop;
+}
+
+// Segment for the bucket holding timestamp, created in order if missing
+Segment* find_segment(TimeWindow* w, int64_t timestamp) {
+    int64_t start = timestamp / w->bucket_seconds * w->bucket_seconds;
+    if (start > timestamp) start -= w->bucket_seconds;   // Round negative times down
+
+    // Calls mostly arrive in time order, so search from the newest segment
+    int i = w->count;
+    while (i > 0 && w->segments[i - 1]->start > start) i--;
+    if (i > 0 && w->segments[i - 1]->start == start) return w->segments[i - 1];
+
+    if (w->count == w->capacity) {
+        int capacity = w->capacity ? w->capacity * 2 : 16;
+        Segment** segments = (Segment**)realloc(w->segments, capacity * sizeof(Segment*));
+        if (!segments) return NULL;
+        w->segments = segments;
+        w->capacity = capacity;
+    }
+    Segment* seg = (Segment*)calloc(1, sizeof(Segment));
+    if (!seg) return NULL;
+    seg->start = start;
+    memmove(w->segments + i + 1, w->segments + i, (w->count - i) * sizeof(Segment*));
+    w->segments[i] = seg;
+    w->count++;
+    return seg;
+}
+
+// Record one call in the bucket for its timestamp, picked up by the next
+// build_graph. Calls already older than the window are counted and dropped.
+int window_add(Graph* g, NodeId from, NodeId to, int64_t timestamp) {
+    TimeWindow* w = &g->window;
+    if (from == to) return 1;
+    if (w->retention && w->count && timestamp < w->newest - w->retention) {
+        w->expired_calls++;
+        return 1;
+    }
+
+    Segment* seg = find_segment(w, timestamp);
+    if (seg && seg->pending_count == seg->pending_capacity) {
+        uint64_t capacity = seg->pending_capacity ? seg->pending_capacity * 2 : 64;
+        TimedContact* pending = (TimedContact*)realloc(seg->pending, capacity * sizeof(TimedContact));
+        if (pending) {
+            seg->pending = pending;
+            seg->pending_capacity = capacity;
+        } else {
+            seg = NULL;
+        }
+    }
+    if (!seg) {
+        printf("Error: Out of memory\n");
+        return 0;
+    }
+
+    TimedContact* call = &seg->pending[seg->pending_count++];
+    call->from = from < to ? from : to;
+    call->to = from < to ? to : from;
+    call->first_seen = call->last_seen = timestamp;
+    call->calls = 1;
+
+    if (w->count == 0 || timestamp > w->newest) {
+        w->newest = timestamp;
+        expire_segments(w);
+    }
+    return 1;
+}
+
+// Merge pending connections into the CSR arrays: each neighbour list ends
+// up sorted and free of duplicates. Lists are sorted in parallel over
+// node ranges of roughly equal edge count. In windowed mode only the
+// segments that received calls are rebuilt. Returns 0 on allocation failure.
+int build_graph(Graph* g) {
+    if (g->window.enabled) return build_window(&g->window);
+    if (!g->pending_count && g->csr_size == g->size) return 1;
+    if (g->packed && !unpack_graph(g)) return 0;
+
+    NodeId n = g->size;
+    uint64_t* offsets = (uint64_t*)calloc((size_t)n + 1, sizeof(uint64_t));
+    if (!offsets) {
+        printf("Error: Out of memory\n");
+        return 0;
+    }
+
+    // Count old and new neighbours per node, then prefix-sum into offsets
+    for (NodeId v = 0; v < g->csr_size; v++) offsets[v + 1] = degree(g, v);
+    for (uint64_t e = 0; e < g->pending_count; e++) {
+        offsets[g->pending[e].from + 1]++;
+        offsets[g->pending[e].to + 1]++;
+    }
+    for (NodeId v = 0; v < n; v++) offsets[v + 1] += offsets[v];
+
+    NodeId* neighbors = (NodeId*)malloc((offsets[n] ? offsets[n] : 1) * sizeof(NodeId));
+    uint64_t* fill = (uint64_t*)malloc(((size_t)n + 1) * sizeof(uint64_t));
+    NodeId* unique = (NodeId*)malloc(((size_t)n + 1) * sizeof(NodeId));
+    if (!neighbors || !fill || !unique) {
+        printf("Error: Out of memory\n");
+        free(offsets);
+        free(neighbors);
+        free(fill);
+        free(unique);
+        return 0;
+    }
+    memcpy(fill, offsets, ((size_t)n + 1) * sizeof(uint64_t));
+
+    for (NodeId v = 0; v < g->csr_size; v++) {
+        uint64_t d = degree(g, v);
+        memcpy(&neighbors[fill[v]], &g->neighbors[g->offsets[v]], d * sizeof(NodeId));
+        fill[v] += d;
+    }
+    for (uint64_t e = 0; e < g->pending_count; e++) {
+        EdgePair p = g->pending[e];
+        neighbors[fill[p.from]++] = p.to;
+        neighbors[fill[p.to]++] = p.from;
+    }
+    free(fill);
+
+    SortTask tasks[MAX_THREADS];
+    int count = thread_count;
+    for (int t = 0; t < count; t++) {
+        tasks[t].neighbors = neighbors;
+        tasks[t].offsets = offsets;
+        tasks[t].unique = unique;
+        tasks[t].first = t == 0 ? 0 : tasks[t - 1].last;
+        tasks[t].last = t == count - 1 ? n : node_at(offsets, n, offsets[n] / count * (t + 1));
+        if (tasks[t].last < tasks[t].first) tasks[t].last = tasks[t].first;
+    }
+    run_parallel(sort_lists_worker, tasks, sizeof(SortTask), count);
+
+    // Close the gaps between the compacted ranges, then rebuild offsets
+    uint64_t out = 0;
+    for (int t = 0; t < count; t++) {
+        uint64_t begin = offsets[tasks[t].first];
+        memmove(&neighbors[out], &neighbors[begin], (tasks[t].end - begin) * sizeof(NodeId));
+        out += tasks[t].end - begin;
+    }
+    offsets[0] = 0;
+    for (NodeId v = 0; v < n; v++) offsets[v + 1] = offsets[v] + unique[v];
+    free(unique);
+
+    NodeId* shrunk = (NodeId*)realloc(neighbors, (out ? out : 1) * sizeof(NodeId));
+    if (shrunk) neighbors = shrunk;
+
+    free(g->offsets);
+    free(g->neighbors);
+    g->offsets = offsets;
+    g->neighbors = neighbors;
+    g->csr_size = n;
+    g->entries = out;
+    g->pending_count = 0;
+    return g->compress ? compress_graph(g) : 1;
+}
+
+// Snapshot the contacts active in the query range into the plain CSR and
+// leave windowed mode, for analyses that need one static graph
+int flatten_window(Graph* g) {
+    TimeWindow* w = &g->window;
+    if (!build_window(w)) return 0;
+    for (int i = 0; i < w->count; i++) {
+        Segment* seg = w->segments[i];
+        if (!segment_in_range(w, seg)) continue;
+        for (NodeId s = 0; s < seg->node_count; s++) {
+            for (uint64_t e = seg->offsets[s]; e < seg->offsets[s + 1]; e++) {
+                if (seg->neighbors[e] < seg->nodes[s] || seg->first_seen[e] > w->query_to ||
+                    seg->last_seen[e] < w->query_from) continue;
+                if (!add_edge(g, seg->nodes[s], seg->neighbors[e])) return 0;
+            }
+        }
+    }
+    w->enabled = 0;
+    return build_graph(g);
+}
+
+int compare_contact(const void* a, const void* b) {
+    const TimedContact* x = (const TimedContact*)a;
+    const TimedContact* y = (const TimedContact*)b;
+    return (x->to > y->to) - (x->to < y->to);
+}
+
+// Print a node's contacts in the query range with call counts and last call
+// time, merged across buckets. Only the node's own list in each in-range
+// segment is read.
+void print_window_contacts(Graph* g, NodeId idx, const char* number) {
+    TimedContact* found = (TimedContact*)malloc((degree(g, idx) + 1) * sizeof(TimedContact));
+    if (!found) {
+        printf("Error: Out of memory\n");
+        return;
+    }
+    uint64_t count = 0;
+    NeighborCursor c;
+    NodeId v;
+    for (open_neighbors(g, idx, &c); next_neighbor(&c, &v); count++) {
+        found[count].to = v;
+        found[count].calls = c.calls;
+        found[count].last_seen = c.last_seen;
+    }
+    qsort(found, count, sizeof(TimedContact), compare_contact);
+
+    uint64_t unique = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        if (unique && found[unique - 1].to == found[i].to) {
+            found[unique - 1].calls += found[i].calls;
+            if (found[i].last_seen > found[unique - 1].last_seen) found[unique - 1].last_seen = found[i].last_seen;
+        } else {
+            found[unique++] = found[i];
+        }
+    }
+
+    printf("Direct contacts of %s:\n", number);
+    char formatted[PHONE_LENGTH];
+    for (uint64_t i = 0; i < unique; i++) {
+        format_number(g->numbers[found[i].to], formatted);
+        printf("- %s (%u calls, last %lld)\n", formatted, found[i].calls, (long long)found[i].last_seen);
+    }
+    if (unique == 0) {
+        printf("No direct contacts found\n");
+    }
+    free(found);
 }
 
 // Print all direct contacts of a number
 void print_direct_contacts(Graph* g, const char* number) {
-    int idx = find_number(g, number);
-    if (idx == -1) {
+    build_graph(g);
+    NodeId idx = find_number(g, number);
+    if (idx == NO_NODE) {
         printf("Number not found in the network\n");
         return;
     }
 
+    if (g->window.enabled) {
+        print_window_contacts(g, idx, number);
+        return;
+    }
+
     printf("Direct contacts of %s:\n", number);
-    int found = 0;
-    for (int i = 0; i < g->size; i++) {
-        if (g->adjacency[idx][i]) {
-            printf("- %s\n", g->numbers[i]);
-            found = 1;
-        }
+    char formatted[PHONE_LENGTH];
+    NeighborCursor c;
+    NodeId v;
+    for (open_neighbors(g, idx, &c); next_neighbor(&c, &v);) {
+        format_number(g->numbers[v], formatted);
+        printf("- %s\n", formatted);
     }
-    
-    if (!found) {
+
+    if (degree(g, idx) == 0) {
         printf("No direct contacts found\n");
     }
 }
 
 // Print adjacency matrix
 void print_adjacency_matrix(Graph* g) {
+    if (g->size > MATRIX_PRINT_LIMIT) {
+        printf("\nAdjacency matrix omitted: %u numbers (limit %d)\n", g->size, MATRIX_PRINT_LIMIT);
+        return;
+    }
+    build_graph(g);
+
+    char formatted[PHONE_LENGTH];
     printf("\nAdjacency Matrix:\n");
     printf("    ");
-    for (int i = 0; i < g->size; i++) {
-        printf("%s ", g->numbers[i]);
+    for (NodeId i = 0; i < g->size; i++) {
+        format_number(g->numbers[i], formatted);
+        printf("%s ", formatted);
     }
     printf("\n");
 
-    for (int i = 0; i < g->size; i++) {
-        printf("%s ", g->numbers[i]);
-        for (int j = 0; j < g->size; j++) {
-            printf("%d     ", g->adjacency[i][j]);
+    for (NodeId i = 0; i < g->size; i++) {
+        format_number(g->numbers[i], formatted);
+        printf("%s ", formatted);
+        // Windowed lists come one bucket at a time, so mark a row first
+        char row[MATRIX_PRINT_LIMIT] = {0};
+        NeighborCursor c;
+        NodeId next;
+        for (open_neighbors(g, i, &c); next_neighbor(&c, &next);) row[next] = 1;
+        for (NodeId j = 0; j < g->size; j++) {
+            printf("%d     ", row[j]);
         }
         printf("\n");
     }
 }
 
-int main() {
-    Graph g;
-    init_graph(&g);
+// ---- Multi-hop queries ----
 
-    // Add given connections
-    add_connection(&g, "0781", "0782");
-    add_connection(&g, "0781", "0783");
-    add_connection(&g, "0782", "0784");
-    add_connection(&g, "0783", "0785");
-    add_connection(&g, "0784", "0785");
-    add_connection(&g, "0784", "0786");
-    add_connection(&g, "0785", "0787");
-    add_connection(&g, "0786", "0788");
+uint64_t* alloc_bitset(NodeId size) {
+    return (uint64_t*)calloc(((size_t)size + 63) / 64 + 1, sizeof(uint64_t));
+}
+
+int test_bit(const uint64_t* bits, NodeId v) {
+    return (bits[v >> 6] >> (v & 63)) & 1;
+}
+
+void set_bit(uint64_t* bits, NodeId v) {
+    bits[v >> 6] |= 1ULL << (v & 63);
+}
+
+// Expand one level top-down: scan the frontier's neighbour lists
+uint64_t expand_top_down(Graph* g, uint64_t* visited, NodeId* order,
+                         uint64_t begin, uint64_t end) {
+    uint64_t next = end;
+    for (uint64_t i = begin; i < end; i++) {
+        NeighborCursor c;
+        NodeId v;
+        for (open_neighbors(g, order[i], &c); next_neighbor(&c, &v);) {
+            if (!test_bit(visited, v)) {
+                set_bit(visited, v);
+                order[next++] = v;
+            }
+        }
+    }
+    return next;
+}
+
+// Expand one level bottom-up: every unvisited node looks for a parent in
+// the frontier and stops at the first hit. Cheaper than top-down once the
+// frontier holds a large share of the graph's edges.
+uint64_t expand_bottom_up(Graph* g, uint64_t* visited, uint64_t* frontier, NodeId* order,
+                          uint64_t begin, uint64_t end) {
+    uint64_t next = end;
+    NodeId words = (g->size + 63) / 64;
+
+    for (uint64_t i = begin; i < end; i++) set_bit(frontier, order[i]);
+    for (NodeId w = 0; w < words; w++) {
+        uint64_t unvisited = ~visited[w];
+        if (w == words - 1 && (g->size & 63)) unvisited &= (1ULL << (g->size & 63)) - 1;
+        while (unvisited) {
+            NodeId v = w * 64 + __builtin_ctzll(unvisited);
+            unvisited &= unvisited - 1;
+            NeighborCursor c;
+            NodeId u;
+            for (open_neighbors(g, v, &c); next_neighbor(&c, &u);) {
+                if (test_bit(frontier, u)) {
+                    order[next++] = v;
+                    break;
+                }
+            }
+        }
+    }
+    // Mark after the scan so nodes found this level are not used as parents
+    for (uint64_t i = end; i < next; i++) set_bit(visited, order[i]);
+    for (uint64_t i = begin; i < end; i++) frontier[order[i] >> 6] = 0;
+    return next;
+}
+
+// Direction-optimizing BFS from src up to k hops. Returns the reached nodes
+// in BFS order (src first); level_end[d] is one past the last node at depth d.
+// The caller frees the result; NULL on allocation failure.
+NodeId* khop_neighbourhood(Graph* g, NodeId src, int k, uint64_t level_end[]) {
+    NodeId* order = (NodeId*)malloc((size_t)g->size * sizeof(NodeId));
+    uint64_t* visited = alloc_bitset(g->size);
+    uint64_t* frontier = alloc_bitset(g->size);
+    if (!order || !visited || !frontier) {
+        free(order);
+        free(visited);
+        free(frontier);
+        return NULL;
+    }
+
+    uint64_t total_edges = total_entries(g);
+    uint64_t explored_edges = degree(g, src);
+    uint64_t begin = 0, end = 1;
+    int bottom_up = 0;
+    order[0] = src;
+    set_bit(visited, src);
+    level_end[0] = 1;
+
+    for (int depth = 1; depth <= k; depth++) {
+        uint64_t frontier_edges = 0;
+        for (uint64_t i = begin; i < end; i++) frontier_edges += degree(g, order[i]);
+
+        // Beamer's heuristic: go bottom-up when the frontier's edges outweigh
+        // the unexplored ones, return once the frontier shrinks again
+        uint64_t unexplored = total_edges > explored_edges ? total_edges - explored_edges : 0;
+        if (!bottom_up && frontier_edges > unexplored / BFS_ALPHA) {
+            bottom_up = 1;
+        } else if (bottom_up && end - begin < g->size / BFS_BETA) {
+            bottom_up = 0;
+        }
+
+        uint64_t next = bottom_up
+            ? expand_bottom_up(g, visited, frontier, order, begin, end)
+            : expand_top_down(g, visited, order, begin, end);
+        for (uint64_t i = end; i < next; i++) explored_edges += degree(g, order[i]);
+        begin = end;
+        end = next;
+        level_end[depth] = end;
+    }
+
+    free(visited);
+    free(frontier);
+    return order;
+}
+
+// Print everyone within k hops of a number, grouped by distance
+void print_khop_contacts(Graph* g, const char* number, int k) {
+    build_graph(g);
+    NodeId src = find_number(g, number);
+    if (src == NO_NODE) {
+        printf("Number not found in the network\n");
+        return;
+    }
+    if (k < 1 || k > MAX_HOPS) {
+        printf("Error: Hops must be between 1 and %d\n", MAX_HOPS);
+        return;
+    }
+
+    uint64_t level_end[MAX_HOPS + 1];
+    NodeId* order = khop_neighbourhood(g, src, k, level_end);
+    if (!order) {
+        printf("Error: Out of memory\n");
+        return;
+    }
+
+    char formatted[PHONE_LENGTH];
+    printf("Contacts of %s within %d hops: %llu\n", number, k,
+           (unsigned long long)(level_end[k] - 1));
+    for (int depth = 1; depth <= k; depth++) {
+        uint64_t begin = level_end[depth - 1], end = level_end[depth];
+        printf("%d hop%s: %llu\n", depth, depth == 1 ? "" : "s", (unsigned long long)(end - begin));
+        for (uint64_t i = begin; i < end && i < begin + HOP_PRINT_LIMIT; i++) {
+            format_number(g->numbers[order[i]], formatted);
+            printf("- %s\n", formatted);
+        }
+        if (end - begin > HOP_PRINT_LIMIT) {
+            printf("  ... and %llu more\n", (unsigned long long)(end - begin - HOP_PRINT_LIMIT));
+        }
+    }
+    free(order);
+}
+
+// Shortest call chain between two numbers by bidirectional BFS: always grow
+// the side whose frontier has fewer edges. Writes the chain into path[] and
+// returns its node count, 0 if unconnected, -1 on allocation failure.
+long shortest_chain(Graph* g, NodeId from, NodeId to, NodeId* path) {
+    if (from == to) {
+        path[0] = from;
+        return 1;
+    }
+
+    NodeId* order[2];
+    NodeId* parent[2];
+    uint64_t* visited[2];
+    uint64_t begin[2] = {0, 0}, end[2] = {1, 1};
+    long length = -1;
+    for (int s = 0; s < 2; s++) {
+        order[s] = (NodeId*)malloc((size_t)g->size * sizeof(NodeId));
+        parent[s] = (NodeId*)malloc((size_t)g->size * sizeof(NodeId));
+        visited[s] = alloc_bitset(g->size);
+    }
+    if (!order[0] || !order[1] || !parent[0] || !parent[1] || !visited[0] || !visited[1]) {
+        goto done;
+    }
+
+    order[0][0] = from;
+    order[1][0] = to;
+    parent[0][from] = parent[1][to] = NO_NODE;
+    set_bit(visited[0], from);
+    set_bit(visited[1], to);
+    NodeId meet = NO_NODE;
+
+    while (meet == NO_NODE && begin[0] < end[0] && begin[1] < end[1]) {
+        uint64_t work[2] = {0, 0};
+        for (int s = 0; s < 2; s++) {
+            for (uint64_t i = begin[s]; i < end[s]; i++) work[s] += degree(g, order[s][i]);
+        }
+        int s = work[0] <= work[1] ? 0 : 1;
+
+        uint64_t next = end[s];
+        for (uint64_t i = begin[s]; i < end[s] && meet == NO_NODE; i++) {
+            NodeId u = order[s][i], v;
+            NeighborCursor c;
+            for (open_neighbors(g, u, &c); next_neighbor(&c, &v);) {
+                if (test_bit(visited[s], v)) continue;
+                set_bit(visited[s], v);
+                parent[s][v] = u;
+                order[s][next++] = v;
+                if (test_bit(visited[1 - s], v)) {
+                    meet = v;
+                    break;
+                }
+            }
+        }
+        begin[s] = end[s];
+        end[s] = next;
+    }
+
+    length = 0;
+    if (meet != NO_NODE) {
+        // from -> meet along forward parents, then meet -> to along backward ones
+        for (NodeId v = meet; v != NO_NODE; v = parent[0][v]) path[length++] = v;
+        for (long i = 0, j = length - 1; i < j; i++, j--) {
+            NodeId t = path[i];
+            path[i] = path[j];
+            path[j] = t;
+        }
+        for (NodeId v = parent[1][meet]; v != NO_NODE; v = parent[1][v]) path[length++] = v;
+    }
+
+done:
+    for (int s = 0; s < 2; s++) {
+        free(order[s]);
+        free(parent[s]);
+        free(visited[s]);
+    }
+    return length;
+}
+
+void print_shortest_chain(Graph* g, const char* from, const char* to) {
+    build_graph(g);
+    NodeId a = find_number(g, from);
+    NodeId b = find_number(g, to);
+    if (a == NO_NODE || b == NO_NODE) {
+        printf("Number not found in the network\n");
+        return;
+    }
+
+    NodeId* path = (NodeId*)malloc((size_t)g->size * sizeof(NodeId));
+    long length = path ? shortest_chain(g, a, b, path) : -1;
+    if (length < 0) {
+        printf("Error: Out of memory\n");
+    } else if (length == 0) {
+        printf("No call chain links %s and %s\n", from, to);
+    } else {
+        char formatted[PHONE_LENGTH];
+        printf("Shortest call chain (%ld hop%s): ", length - 1, length == 2 ? "" : "s");
+        for (long i = 0; i < length; i++) {
+            format_number(g->numbers[path[i]], formatted);
+            printf("%s%s", formatted, i < length - 1 ? " -> " : "\n");
+        }
+    }
+    free(path);
+}
+
+// ---- Call-detail record ingestion ----
+
+typedef struct {
+    PhoneKey caller;
+    PhoneKey callee;
+    int64_t timestamp;
+    int64_t duration;
+} CallRecord;
+
+int is_separator(char c) {
+    return c == ',' || c == ';' || c == ' ' || c == '\t' || c == '\r';
+}
+
+// Parse a phone number in place, advancing *cursor past it. Returns 0 if malformed.
+PhoneKey parse_number(const char** cursor, const char* end) {
+    const char* p = *cursor;
+    PhoneKey plus = 0, value = 0;
+    int digits = 0;
+
+    if (p < end && *p == '+') {
+        plus = 1;
+        p++;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (digits == MAX_DIGITS) return 0;
+        value = value * 10 + (*p++ - '0');
+        digits++;
+    }
+    *cursor = p;
+    if (digits == 0) return 0;
+    return (plus << 63) | ((PhoneKey)digits << 56) | value;
+}
+
+// Parse a signed integer, advancing *cursor past it. *ok is 0 if there are
+// no digits or the value does not fit in 64 bits.
+int64_t parse_integer(const char** cursor, const char* end, int* ok) {
+    const char* p = *cursor;
+    uint64_t value = 0;
+    int negative = p < end && *p == '-';
+    if (negative) p++;
+    *ok = p < end && *p >= '0' && *p <= '9';
+    while (p < end && *p >= '0' && *p <= '9') {
+        unsigned digit = *p++ - '0';
+        if (value > (uint64_t)(INT64_MAX - digit) / 10) *ok = 0;
+        else value = value * 10 + digit;
+    }
+    *cursor = p;
+    return negative ? -(int64_t)value : (int64_t)value;
+}
+
+void skip_separators(const char** cursor, const char* end) {
+    while (*cursor < end && is_separator(**cursor)) (*cursor)++;
+}
+
+// Tokenize one "caller,callee,timestamp,duration" line straight out of the
+// input buffer without copying it. Commas, semicolons, tabs or spaces may
+// separate fields; timestamp and duration are optional. Returns 1 for a
+// record, -1 for a malformed line (skipped) and 0 at the end of input.
+int next_record(const char** cursor, const char* end, CallRecord* record) {
+    const char* p = *cursor;
+    while (p < end && (*p == '\n' || is_separator(*p))) p++;
+    if (p == end) {
+        *cursor = p;
+        return 0;
+    }
+
+    int ok = 1, has_field;
+    record->timestamp = 0;
+    record->duration = 0;
+    record->caller = parse_number(&p, end);
+    skip_separators(&p, end);
+    record->callee = parse_number(&p, end);
+    skip_separators(&p, end);
+    if (p < end && *p != '\n') {
+        record->timestamp = parse_integer(&p, end, &has_field);
+        ok &= has_field;
+        skip_separators(&p, end);
+    }
+    if (ok && p < end && *p != '\n') {
+        record->duration = parse_integer(&p, end, &has_field);
+        ok &= has_field;
+        skip_separators(&p, end);
+    }
+    ok &= record->caller && record->callee && (p == end || *p == '\n');
+
+    while (p < end && *p != '\n') p++;
+    *cursor = p;
+    return ok ? 1 : -1;
+}
+
+typedef struct {
+    uint64_t records;
+    uint64_t malformed;
+    uint64_t edges;         // Unique edges after per-block deduplication
+    double seconds;
+} IngestStats;
+
+// One thread's slice of an input block and its private buffers
+typedef struct {
+    Graph* g;
+    const char* begin;
+    const char* end;
+    PhoneKey* keys;         // Caller and callee key per record
+    int64_t* times;         // Call time per record
+    NodeId* ids;            // Resolved IDs, NO_NODE until known
+    uint64_t* edges;        // Packed (low << 32 | high) edges
+    uint64_t* scratch;
+    uint64_t count;
+    uint64_t capacity;
+    uint64_t malformed;
+    uint64_t edge_count;
+    uint64_t unresolved;
+    int failed;
+} IngestWorker;
+
+// Parse the worker's slice into caller/callee key pairs
+void* parse_worker(void* arg) {
+    IngestWorker* w = (IngestWorker*)arg;
+    const char* cursor = w->begin;
+    CallRecord record;
+    int status;
+
+    w->count = 0;
+    w->malformed = 0;
+    while ((status = next_record(&cursor, w->end, &record)) != 0) {
+        if (status < 0) {
+            w->malformed++;
+            continue;
+        }
+        if (w->count == w->capacity) {
+            uint64_t capacity = w->capacity ? w->capacity * 2 : 4096;
+            PhoneKey* keys = (PhoneKey*)realloc(w->keys, 2 * capacity * sizeof(PhoneKey));
+            if (keys) w->keys = keys;
+            int64_t* times = (int64_t*)realloc(w->times, capacity * sizeof(int64_t));
+            if (times) w->times = times;
+            if (!keys || !times) {
+                w->failed = 1;
+                return NULL;
+            }
+            w->capacity = capacity;
+        }
+        w->keys[2 * w->count] = record.caller;
+        w->keys[2 * w->count + 1] = record.callee;
+        w->times[w->count] = record.timestamp;
+        w->count++;
+    }
+    return NULL;
+}
+
+// Map keys to IDs using the (read-only) hash index, leaving unknown numbers as NO_NODE
+void* resolve_worker(void* arg) {
+    IngestWorker* w = (IngestWorker*)arg;
+    NodeId* ids = (NodeId*)realloc(w->ids, (2 * w->count + 1) * sizeof(NodeId));
+    if (!ids) {
+        w->failed = 1;
+        return NULL;
+    }
+    w->ids = ids;
+    w->unresolved = 0;
+    for (uint64_t i = 0; i < 2 * w->count; i++) {
+        ids[i] = find_key(w->g, w->keys[i]);
+        w->unresolved += ids[i] == NO_NODE;
+    }
+    return NULL;
+}
+
+// LSD radix sort on 16-bit digits, skipping digits above the largest value
+void radix_sort(uint64_t* data, uint64_t* scratch, uint64_t count) {
+    uint64_t max = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        if (data[i] > max) max = data[i];
+    }
+
+    for (int shift = 0; shift < 64 && (max >> shift); shift += 16) {
+        uint64_t buckets[65537] = {0};
+        for (uint64_t i = 0; i < count; i++) buckets[((data[i] >> shift) & 0xFFFF) + 1]++;
+        for (int b = 0; b < 65536; b++) buckets[b + 1] += buckets[b];
+        for (uint64_t i = 0; i < count; i++) scratch[buckets[(data[i] >> shift) & 0xFFFF]++] = data[i];
+        memcpy(data, scratch, count * sizeof(uint64_t));
+    }
+}
+
+// Build a sorted, duplicate-free edge buffer. ingest_block has registered
+// every number by now, so all IDs are resolved.
+void* edge_worker(void* arg) {
+    IngestWorker* w = (IngestWorker*)arg;
+    uint64_t* edges = (uint64_t*)realloc(w->edges, (w->count + 1) * sizeof(uint64_t));
+    uint64_t* scratch = (uint64_t*)realloc(w->scratch, (w->count + 1) * sizeof(uint64_t));
+    if (edges) w->edges = edges;
+    if (scratch) w->scratch = scratch;
+    if (!edges || !scratch) {
+        w->failed = 1;
+        return NULL;
+    }
+
+    w->edge_count = 0;
+    for (uint64_t r = 0; r < w->count; r++) {
+        NodeId a = w->ids[2 * r], b = w->ids[2 * r + 1];
+        if (a == b) continue;
+        if (a > b) {
+            NodeId t = a;
+            a = b;
+            b = t;
+        }
+        edges[w->edge_count++] = ((uint64_t)a << 32) | b;
+    }
+
+    radix_sort(edges, scratch, w->edge_count);
+    uint64_t out = 0;
+    for (uint64_t i = 0; i < w->edge_count; i++) {
+        if (i == 0 || edges[i] != edges[i - 1]) edges[out++] = edges[i];
+    }
+    w->edge_count = out;
+    return NULL;
+}
+
+// Reserve room for extra pending edges
+int reserve_pending(Graph* g, uint64_t extra) {
+    if (g->pending_count + extra <= g->pending_capacity) return 1;
+    uint64_t capacity = g->pending_capacity ? g->pending_capacity : 64;
+    while (capacity < g->pending_count + extra) capacity *= 2;
+    EdgePair* pending = (EdgePair*)realloc(g->pending, capacity * sizeof(EdgePair));
+    if (!pending) return 0;
+    g->pending = pending;
+    g->pending_capacity = capacity;
+    return 1;
+}
+
+// Ingest one buffer of complete lines: split it at line boundaries across
+// the workers, parse and resolve in parallel, register new numbers on this
+// thread (so IDs are assigned in input order), then dedup per thread. In
+// windowed mode every call is kept with its time and filed into its bucket.
+int ingest_block(Graph* g, IngestWorker* workers, const char* data, uint64_t length,
+                 IngestStats* stats) {
+    int count = thread_count;
+    const char* cursor = data;
+    const char* end = data + length;
+
+    for (int t = 0; t < count; t++) {
+        workers[t].g = g;
+        workers[t].begin = cursor;
+        const char* split = t == count - 1 ? end : data + length / count * (t + 1);
+        if (split < cursor) split = cursor;
+        while (split < end && *split != '\n') split++;
+        workers[t].end = split;
+        cursor = split;
+    }
+
+    run_parallel(parse_worker, workers, sizeof(IngestWorker), count);
+    run_parallel(resolve_worker, workers, sizeof(IngestWorker), count);
+    for (int t = 0; t < count; t++) {
+        if (workers[t].failed) return 0;
+        for (uint64_t i = 0; workers[t].unresolved && i < 2 * workers[t].count; i++) {
+            if (workers[t].ids[i] == NO_NODE) {
+                workers[t].ids[i] = add_key(g, workers[t].keys[i]);
+                if (workers[t].ids[i] == NO_NODE) return 0;
+            }
+        }
+    }
+
+    if (g->window.enabled) {
+        for (int t = 0; t < count; t++) {
+            IngestWorker* w = &workers[t];
+            for (uint64_t r = 0; r < w->count; r++) {
+                if (!window_add(g, w->ids[2 * r], w->ids[2 * r + 1], w->times[r])) return 0;
+            }
+            stats->records += w->count;
+            stats->malformed += w->malformed;
+        }
+        return 1;
+    }
+    run_parallel(edge_worker, workers, sizeof(IngestWorker), count);
+
+    for (int t = 0; t < count; t++) {
+        IngestWorker* w = &workers[t];
+        if (w->failed || !reserve_pending(g, w->edge_count)) return 0;
+        for (uint64_t i = 0; i < w->edge_count; i++) {
+            g->pending[g->pending_count].from = (NodeId)(w->edges[i] >> 32);
+            g->pending[g->pending_count].to = (NodeId)w->edges[i];
+            g->pending_count++;
+        }
+        stats->records += w->count;
+        stats->malformed += w->malformed;
+        stats->edges += w->edge_count;
+    }
+    return 1;
+}
+
+void free_workers(IngestWorker* workers) {
+    for (int t = 0; t < MAX_THREADS; t++) {
+        free(workers[t].keys);
+        free(workers[t].times);
+        free(workers[t].ids);
+        free(workers[t].edges);
+        free(workers[t].scratch);
+    }
+}
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Load call-detail records from a file (memory-mapped) or "-" for stdin
+// (read in INGEST_BLOCK_SIZE blocks) and merge them into the graph
+int ingest_cdr(Graph* g, const char* path, IngestStats* stats) {
+    IngestWorker workers[MAX_THREADS];
+    memset(workers, 0, sizeof(workers));
+    memset(stats, 0, sizeof(*stats));
+    double start = now_seconds();
+    int ok = 1;
+
+    if (strcmp(path, "-") != 0) {
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            printf("Error: Could not open %s\n", path);
+            if (fd >= 0) close(fd);
+            return 0;
+        }
+        if (st.st_size > 0) {
+            void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                printf("Error: Could not map %s\n", path);
+                close(fd);
+                return 0;
+            }
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            ok = ingest_block(g, workers, (const char*)data, st.st_size, stats);
+            munmap(data, st.st_size);
+        }
+        close(fd);
+    } else {
+        char* buffer = (char*)malloc(INGEST_BLOCK_SIZE);
+        size_t carry = 0, got;
+        if (!buffer) ok = 0;
+        while (ok && (got = fread(buffer + carry, 1, INGEST_BLOCK_SIZE - carry, stdin)) > 0) {
+            size_t length = carry + got;
+            size_t complete = length;
+            while (complete > 0 && buffer[complete - 1] != '\n') complete--;
+            if (complete == 0) {
+                if (length < INGEST_BLOCK_SIZE) {
+                    carry = length;
+                    continue;
+                }
+                complete = length;   // A single line filling the block: let it be rejected
+            }
+            ok = ingest_block(g, workers, buffer, complete, stats);
+            carry = length - complete;
+            memmove(buffer, buffer + complete, carry);
+        }
+        if (ok && carry > 0) ok = ingest_block(g, workers, buffer, carry, stats);
+        free(buffer);
+    }
+
+    free_workers(workers);
+    ok = ok && build_graph(g);
+    if (!ok) printf("Error: Out of memory during ingestion\n");
+    stats->seconds = now_seconds() - start;
+    return ok;
+}
+
+void print_ingest_stats(Graph* g, IngestStats* stats) {
+    printf("Ingested %llu records (%llu malformed) in %.2f s, %.0f records/s\n",
+           (unsigned long long)stats->records, (unsigned long long)stats->malformed,
+           stats->seconds, stats->seconds > 0 ? stats->records / stats->seconds : 0.0);
+    if (!g->window.enabled) {
+        printf("Graph: %u numbers, %llu contacts\n", g->size,
+               (unsigned long long)(g->entries / 2));
+        return;
+    }
+    TimeWindow* w = &g->window;
+    uint64_t contacts = 0;
+    for (int i = 0; i < w->count; i++) contacts += w->segments[i]->entries / 2;
+    printf("Window: %u numbers, %d buckets holding %llu contacts, %llu buckets expired, "
+           "%llu late calls dropped\n", g->size, w->count, (unsigned long long)contacts,
+           (unsigned long long)w->expired_segments, (unsigned long long)w->expired_calls);
+}
+
+// ---- Graph analytics ----
+
+typedef struct {
+    NodeId* component;      // Smallest node ID in the node's connected component
+    NodeId* community;      // Louvain community, dense IDs from 0
+    float* rank;            // PageRank score
+    NodeId components;
+    NodeId largest_component;
+    NodeId communities;
+    double modularity;
+} Analysis;
+
+// Find the root of v with path halving. Concurrent finds only ever shorten
+// paths, so the relaxed races between threads are benign.
+NodeId find_root(NodeId* parent, NodeId v) {
+    NodeId p = __atomic_load_n(&parent[v], __ATOMIC_RELAXED);
+    while (p != v) {
+        NodeId grandparent = __atomic_load_n(&parent[p], __ATOMIC_RELAXED);
+        __atomic_store_n(&parent[v], grandparent, __ATOMIC_RELAXED);
+        v = p;
+        p = grandparent;
+    }
+    return v;
+}
+
+typedef struct {
+    Graph* g;
+    NodeId* parent;
+    NodeId first;
+    NodeId last;
+} UnionTask;
+
+// Union every edge in the node range. Roots are linked larger-to-smaller
+// with a CAS, so concurrent unions never form cycles.
+void* union_worker(void* arg) {
+    UnionTask* task = (UnionTask*)arg;
+    Graph* g = task->g;
+
+    for (NodeId u = task->first; u < task->last; u++) {
+        NeighborCursor c;
+        NodeId v;
+        for (open_neighbors(g, u, &c); next_neighbor(&c, &v);) {
+            if (v < u) continue;   // Each undirected edge once
+            while (1) {
+                NodeId a = find_root(task->parent, u);
+                NodeId b = find_root(task->parent, v);
+                if (a == b) break;
+                if (a > b) {
+                    NodeId t = a;
+                    a = b;
+                    b = t;
+                }
+                NodeId expected = b;
+                if (__atomic_compare_exchange_n(&task->parent[b], &expected, a, 0,
+                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                    break;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+void* flatten_worker(void* arg) {
+    UnionTask* task = (UnionTask*)arg;
+    for (NodeId v = task->first; v < task->last; v++) {
+        __atomic_store_n(&task->parent[v], find_root(task->parent, v), __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+// Split [0, n) into thread_count ranges of roughly equal edge count
+void split_ranges(Graph* g, NodeId first[], NodeId last[]) {
+    uint64_t total = g->offsets[g->csr_size];
+    for (int t = 0; t < thread_count; t++) {
+        first[t] = t == 0 ? 0 : last[t - 1];
+        last[t] = t == thread_count - 1 ? g->size : node_at(g->offsets, g->size, total / thread_count * (t + 1));
+        if (last[t] < first[t]) last[t] = first[t];
+    }
+}
+
+// Label every node with the smallest ID in its connected component
+int connected_components(Graph* g, Analysis* a) {
+    NodeId* parent = (NodeId*)malloc(((size_t)g->size + 1) * sizeof(NodeId));
+    NodeId* sizes = (NodeId*)calloc((size_t)g->size + 1, sizeof(NodeId));
+    if (!parent || !sizes) {
+        free(parent);
+        free(sizes);
+        return 0;
+    }
+    for (NodeId v = 0; v < g->size; v++) parent[v] = v;
+
+    UnionTask tasks[MAX_THREADS];
+    NodeId first[MAX_THREADS], last[MAX_THREADS];
+    split_ranges(g, first, last);
+    for (int t = 0; t < thread_count; t++) {
+        tasks[t].g = g;
+        tasks[t].parent = parent;
+        tasks[t].first = first[t];
+        tasks[t].last = last[t];
+    }
+    run_parallel(union_worker, tasks, sizeof(UnionTask), thread_count);
+    for (int t = 0; t < thread_count; t++) {
+        tasks[t].first = (NodeId)((uint64_t)g->size * t / thread_count);
+        tasks[t].last = (NodeId)((uint64_t)g->size * (t + 1) / thread_count);
+    }
+    run_parallel(flatten_worker, tasks, sizeof(UnionTask), thread_count);
+
+    a->components = 0;
+    a->largest_component = 0;
+    for (NodeId v = 0; v < g->size; v++) {
+        if (parent[v] == v) a->components++;
+        if (++sizes[parent[v]] > a->largest_component) a->largest_component = sizes[parent[v]];
+    }
+    free(sizes);
+    a->component = parent;
+    return 1;
+}
+
+// Weighted graph for one Louvain level. Each undirected edge appears in both
+// lists; a node's self-loop entry holds the weight internal to it.
+typedef struct {
+    NodeId size;
+    uint64_t* offsets;
+    NodeId* neighbors;
+    double* weights;
+    double total;           // Sum of all entries (twice the edge weight)
+} LevelGraph;
+
+void free_level(LevelGraph* lg) {
+    free(lg->offsets);
+    free(lg->neighbors);
+    free(lg->weights);
+}
+
+// Move nodes between communities while modularity improves.
+// Returns the number of moves made across all passes.
+uint64_t louvain_local_moves(LevelGraph* lg, NodeId* community, double* tot,
+                             double* link, NodeId* touched) {
+    uint64_t moves = 0, moved;
+    NodeId n = lg->size;
+
+    for (NodeId v = 0; v < n; v++) {
+        community[v] = v;
+        tot[v] = 0;
+        for (uint64_t e = lg->offsets[v]; e < lg->offsets[v + 1]; e++) tot[v] += lg->weights[e];
+        link[v] = -1;
+    }
+
+    for (int pass = 0; pass < LOUVAIN_MAX_PASSES; pass++) {
+        moved = 0;
+        for (NodeId v = 0; v < n; v++) {
+            NodeId current = community[v];
+            double k = 0;
+            NodeId count = 0;
+
+            // Weight from v to each neighbouring community
+            for (uint64_t e = lg->offsets[v]; e < lg->offsets[v + 1]; e++) {
+                NodeId c = community[lg->neighbors[e]];
+                k += lg->weights[e];
+                if (lg->neighbors[e] == v) continue;
+                if (link[c] < 0) {
+                    link[c] = 0;
+                    touched[count++] = c;
+                }
+                link[c] += lg->weights[e];
+            }
+
+            tot[current] -= k;
+            NodeId best = current;
+            double best_gain = (link[current] > 0 ? link[current] : 0) - tot[current] * k / lg->total;
+            for (NodeId i = 0; i < count; i++) {
+                NodeId c = touched[i];
+                double gain = link[c] - tot[c] * k / lg->total;
+                if (gain > best_gain + 1e-12) {
+                    best_gain = gain;
+                    best = c;
+                }
+            }
+            tot[best] += k;
+            if (best != current) {
+                community[v] = best;
+                moved++;
+            }
+
+            for (NodeId i = 0; i < count; i++) link[touched[i]] = -1;
+            link[current] = -1;
+        }
+        moves += moved;
+        if (moved == 0) break;
+    }
+    return moves;
+}
+
+// Collapse each community into one node of the next level
+int louvain_aggregate(LevelGraph* lg, NodeId* community, NodeId groups, LevelGraph* next,
+                      double* link, NodeId* touched) {
+    NodeId* start = (NodeId*)calloc((size_t)groups + 1, sizeof(NodeId));
+    NodeId* members = (NodeId*)malloc(((size_t)lg->size + 1) * sizeof(NodeId));
+    uint64_t capacity = lg->offsets[lg->size] + groups;
+    next->offsets = (uint64_t*)malloc(((size_t)groups + 1) * sizeof(uint64_t));
+    next->neighbors = (NodeId*)malloc(capacity * sizeof(NodeId));
+    next->weights = (double*)malloc(capacity * sizeof(double));
+    if (!start || !members || !next->offsets || !next->neighbors || !next->weights) {
+        free(start);
+        free(members);
+        free_level(next);
+        return 0;
+    }
+
+    // Group nodes by community with a counting sort
+    for (NodeId v = 0; v < lg->size; v++) start[community[v] + 1]++;
+    for (NodeId c = 0; c < groups; c++) start[c + 1] += start[c];
+    for (NodeId v = 0; v < lg->size; v++) members[start[community[v]]++] = v;
+    for (NodeId c = groups; c > 0; c--) start[c] = start[c - 1];
+    start[0] = 0;
+
+    uint64_t out = 0;
+    for (NodeId c = 0; c < groups; c++) {
+        NodeId count = 0;
+        next->offsets[c] = out;
+        for (NodeId m = start[c]; m < start[c + 1]; m++) {
+            NodeId v = members[m];
+            for (uint64_t e = lg->offsets[v]; e < lg->offsets[v + 1]; e++) {
+                NodeId d = community[lg->neighbors[e]];
+                if (link[d] < 0) {
+                    link[d] = 0;
+                    touched[count++] = d;
+                }
+                link[d] += lg->weights[e];
+            }
+        }
+        for (NodeId i = 0; i < count; i++) {
+            next->neighbors[out] = touched[i];
+            next->weights[out++] = link[touched[i]];
+            link[touched[i]] = -1;
+        }
+    }
+    next->offsets[groups] = out;
+    next->size = groups;
+    next->total = lg->total;
+
+    free(start);
+    free(members);
+    return 1;
+}
+
+// Multi-level Louvain community detection. Local moving is sequential;
+// levels repeat until no node changes community.
+int detect_communities(Graph* g, Analysis* a) {
+    NodeId n = g->size;
+    LevelGraph level;
+    level.size = n;
+    level.offsets = (uint64_t*)malloc(((size_t)n + 1) * sizeof(uint64_t));
+    level.neighbors = (NodeId*)malloc((g->entries + 1) * sizeof(NodeId));
+    level.weights = (double*)malloc((g->entries + 1) * sizeof(double));
+    level.total = (double)g->entries;
+
+    NodeId* result = (NodeId*)malloc(((size_t)n + 1) * sizeof(NodeId));
+    NodeId* community = (NodeId*)malloc(((size_t)n + 1) * sizeof(NodeId));
+    NodeId* renumber = (NodeId*)malloc(((size_t)n + 1) * sizeof(NodeId));
+    NodeId* touched = (NodeId*)malloc(((size_t)n + 1) * sizeof(NodeId));
+    double* tot = (double*)malloc(((size_t)n + 1) * sizeof(double));
+    double* link = (double*)malloc(((size_t)n + 1) * sizeof(double));
+    int ok = level.offsets && level.neighbors && level.weights && result && community &&
+             renumber && touched && tot && link;
+
+    if (ok) {
+        uint64_t out = 0;
+        for (NodeId v = 0; v < n; v++) {
+            NeighborCursor c;
+            level.offsets[v] = out;
+            for (open_neighbors(g, v, &c); next_neighbor(&c, &level.neighbors[out]); out++) {}
+        }
+        level.offsets[n] = out;
+        for (uint64_t e = 0; e < out; e++) level.weights[e] = 1.0;
+        for (NodeId v = 0; v < n; v++) result[v] = v;
+    }
+
+    while (ok && level.total > 0) {
+        uint64_t moves = louvain_local_moves(&level, community, tot, link, touched);
+
+        // Renumber communities densely and map original nodes through this level
+        NodeId groups = 0;
+        for (NodeId v = 0; v < level.size; v++) renumber[v] = NO_NODE;
+        for (NodeId v = 0; v < level.size; v++) {
+            if (renumber[community[v]] == NO_NODE) renumber[community[v]] = groups++;
+            community[v] = renumber[community[v]];
+        }
+        for (NodeId v = 0; v < n; v++) result[v] = community[result[v]];
+        if (moves == 0 || groups == level.size) break;
+
+        for (NodeId v = 0; v < groups; v++) link[v] = -1;
+        LevelGraph next;
+        ok = louvain_aggregate(&level, community, groups, &next, link, touched);
+        free_level(&level);
+        level = next;
+    }
+
+    if (ok) {
+        // Modularity of the final partition on the original graph
+        NodeId groups = 0;
+        for (NodeId v = 0; v < n; v++) {
+            if (result[v] + 1 > groups) groups = result[v] + 1;
+        }
+        for (NodeId c = 0; c < groups; c++) tot[c] = link[c] = 0;
+        for (NodeId v = 0; v < n; v++) {
+            NeighborCursor c;
+            NodeId u;
+            for (open_neighbors(g, v, &c); next_neighbor(&c, &u);) {
+                tot[result[v]] += 1;
+                if (result[u] == result[v]) link[result[v]] += 1;
+            }
+        }
+        double m2 = (double)g->entries, q = 0;
+        for (NodeId c = 0; m2 > 0 && c < groups; c++) {
+            q += link[c] / m2 - (tot[c] / m2) * (tot[c] / m2);
+        }
+        a->communities = groups;
+        a->modularity = q;
+        a->community = result;
+    } else {
+        free(result);
+    }
+
+    free_level(&level);
+    free(community);
+    free(renumber);
+    free(touched);
+    free(tot);
+    free(link);
+    return ok;
+}
+
+typedef struct {
+    Graph* g;
+    const float* rank;
+    const float* contribution;
+    float* next;
+    float* out_contribution;
+    NodeId first;
+    NodeId last;
+    double dangling;
+    double change;
+} RankTask;
+
+// Pull-based PageRank step for a node range
+void* pagerank_worker(void* arg) {
+    RankTask* task = (RankTask*)arg;
+    Graph* g = task->g;
+    double base = (1.0 - PAGERANK_DAMPING + PAGERANK_DAMPING * task->dangling) / g->size;
+
+    task->change = 0;
+    for (NodeId v = task->first; v < task->last; v++) {
+        double sum = 0;
+        NeighborCursor c;
+        NodeId u;
+        for (open_neighbors(g, v, &c); next_neighbor(&c, &u);) {
+            sum += task->contribution[u];
+        }
+        float value = (float)(base + PAGERANK_DAMPING * sum);
+        uint64_t d = degree(g, v);
+        task->change += fabs(value - task->rank[v]);
+        task->next[v] = value;
+        task->out_contribution[v] = d ? value / d : 0;
+    }
+    return NULL;
+}
+
+// PageRank by power iteration, parallel over node ranges
+int pagerank(Graph* g, Analysis* a) {
+    NodeId n = g->size;
+    float* rank = (float*)malloc(((size_t)n + 1) * sizeof(float));
+    float* next = (float*)malloc(((size_t)n + 1) * sizeof(float));
+    float* contribution = (float*)malloc(((size_t)n + 1) * sizeof(float));
+    float* next_contribution = (float*)malloc(((size_t)n + 1) * sizeof(float));
+    if (!rank || !next || !contribution || !next_contribution) {
+        free(rank);
+        free(next);
+        free(contribution);
+        free(next_contribution);
+        return 0;
+    }
+
+    for (NodeId v = 0; v < n; v++) {
+        rank[v] = 1.0f / n;
+        contribution[v] = degree(g, v) ? rank[v] / degree(g, v) : 0;
+    }
+
+    RankTask tasks[MAX_THREADS];
+    NodeId first[MAX_THREADS], last[MAX_THREADS];
+    split_ranges(g, first, last);
+    for (int iteration = 0; iteration < PAGERANK_MAX_ITERATIONS; iteration++) {
+        // Rank held by nodes without contacts is spread evenly
+        double dangling = 0;
+        for (NodeId v = 0; v < n; v++) {
+            if (degree(g, v) == 0) dangling += rank[v];
+        }
+
+        double change = 0;
+        for (int t = 0; t < thread_count; t++) {
+            tasks[t] = (RankTask){ g, rank, contribution, next, next_contribution,
+                                   first[t], last[t], dangling, 0 };
+        }
+        run_parallel(pagerank_worker, tasks, sizeof(RankTask), thread_count);
+        for (int t = 0; t < thread_count; t++) change += tasks[t].change;
+
+        float* swap = rank;
+        rank = next;
+        next = swap;
+        swap = contribution;
+        contribution = next_contribution;
+        next_contribution = swap;
+        if (change < PAGERANK_TOLERANCE) break;
+    }
+
+    free(next);
+    free(contribution);
+    free(next_contribution);
+    a->rank = rank;
+    return 1;
+}
+
+void free_analysis(Analysis* a) {
+    free(a->component);
+    free(a->community);
+    free(a->rank);
+}
+
+// Keep the top-n nodes by score in a small sorted array
+void print_top(Graph* g, const char* title, double (*score)(Graph*, Analysis*, NodeId), Analysis* a) {
+    NodeId top[TOP_RANKED];
+    double value[TOP_RANKED];
+    int count = 0;
+
+    for (NodeId v = 0; v < g->size; v++) {
+        double s = score(g, a, v);
+        if (count == TOP_RANKED && s <= value[count - 1]) continue;
+        int i = count < TOP_RANKED ? count++ : count - 1;
+        while (i > 0 && value[i - 1] < s) {
+            top[i] = top[i - 1];
+            value[i] = value[i - 1];
+            i--;
+        }
+        top[i] = v;
+        value[i] = s;
+    }
+
+    char formatted[PHONE_LENGTH];
+    printf("%s:\n", title);
+    for (int i = 0; i < count; i++) {
+        format_number(g->numbers[top[i]], formatted);
+        printf("%2d. %-17s %g\n", i + 1, formatted, value[i]);
+    }
+}
+
+double degree_score(Graph* g, Analysis* a, NodeId v) {
+    (void)a;
+    return (double)degree(g, v);
+}
+
+double rank_score(Graph* g, Analysis* a, NodeId v) {
+    (void)g;
+    return a->rank[v];
+}
+
+// Write one fixed-size little-endian record per node:
+// number (u64), component (u32), community (u32), degree (u32), pagerank (f32)
+int write_analysis(Graph* g, Analysis* a, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        printf("Error: Could not create %s\n", path);
+        return 0;
+    }
+
+    uint32_t header[2] = { ANALYSIS_MAGIC, g->size };
+    int ok = fwrite(header, sizeof(header), 1, file) == 1;
+    for (NodeId v = 0; ok && v < g->size; v++) {
+        unsigned char record[ANALYSIS_RECORD_SIZE];
+        uint32_t d = (uint32_t)degree(g, v);
+        memcpy(record, &g->numbers[v], 8);
+        memcpy(record + 8, &a->component[v], 4);
+        memcpy(record + 12, &a->community[v], 4);
+        memcpy(record + 16, &d, 4);
+        memcpy(record + 20, &a->rank[v], 4);
+        ok = fwrite(record, sizeof(record), 1, file) == 1;
+    }
+    if (fclose(file) != 0) ok = 0;
+    if (!ok) printf("Error: Could not write %s\n", path);
+    return ok;
+}
+
+// Run every analysis, print a summary and write per-node results to path
+int analyze_graph(Graph* g, const char* path) {
+    Analysis a;
+    memset(&a, 0, sizeof(a));
+    build_graph(g);
+
+    double start = now_seconds();
+    int ok = connected_components(g, &a);
+    double components_time = now_seconds() - start;
+
+    start = now_seconds();
+    ok = ok && detect_communities(g, &a);
+    double communities_time = now_seconds() - start;
+
+    start = now_seconds();
+    ok = ok && pagerank(g, &a);
+    double rank_time = now_seconds() - start;
+
+    if (!ok) {
+        printf("Error: Out of memory during analysis\n");
+        free_analysis(&a);
+        return 0;
+    }
+
+    printf("Connected components: %u (largest %u numbers) in %.2f s\n",
+           a.components, a.largest_component, components_time);
+    printf("Communities: %u, modularity %.4f in %.2f s\n", a.communities, a.modularity, communities_time);
+    printf("PageRank computed in %.2f s\n", rank_time);
+    print_top(g, "Most contacts", degree_score, &a);
+    print_top(g, "Highest PageRank", rank_score, &a);
+
+    ok = write_analysis(g, &a, path);
+    if (ok) printf("Per-number results written to %s\n", path);
+    free_analysis(&a);
+    return ok;
+}
+
+// ---- Mutual contacts and triangles ----
+
+// Exponential then binary search for the first position >= key in list[from..count)
+uint64_t gallop(const NodeId* list, uint64_t from, uint64_t count, NodeId key) {
+    uint64_t step = 1, lo = from, hi = from;
+    while (hi < count && list[hi] < key) {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    if (hi > count) hi = count;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (list[mid] < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Intersect two sorted, duplicate-free lists. Writes the common elements
+// to out (if not NULL) and returns how many there are. Very unequal sizes
+// gallop through the longer list; otherwise 4x4 blocks are compared with
+// SSE2 (every rotation of b against a) and the scalar merge handles tails.
+uint64_t intersect_sorted(const NodeId* a, uint64_t na, const NodeId* b, uint64_t nb, NodeId* out) {
+    uint64_t count = 0, i = 0, j = 0;
+
+    if (na > nb) {
+        const NodeId* t = a;
+        a = b;
+        b = t;
+        uint64_t n = na;
+        na = nb;
+        nb = n;
+    }
+    if (na * GALLOP_RATIO < nb) {
+        for (; i < na && j < nb; i++) {
+            j = gallop(b, j, nb, a[i]);
+            if (j < nb && b[j] == a[i]) {
+                if (out) out[count] = a[i];
+                count++;
+            }
+        }
+        return count;
+    }
+
+#ifdef __SSE2__
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i*)&a[i]);
+        __m128i vb = _mm_loadu_si128((const __m128i*)&b[j]);
+        __m128i hits = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va, vb),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(hits));
+        if (out) {
+            for (int m = mask; m; m &= m - 1) out[count++] = a[i + __builtin_ctz(m)];
+        } else {
+            count += __builtin_popcount(mask);
+        }
+
+        NodeId a_max = a[i + 3], b_max = b[j + 3];
+        if (a_max <= b_max) i += 4;
+        if (b_max <= a_max) j += 4;
+    }
+#endif
+
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (a[i] > b[j]) {
+            j++;
+        } else {
+            if (out) out[count] = a[i];
+            count++;
+            i++;
+            j++;
+        }
+    }
+    return count;
+}
+
+// Print the contacts two numbers have in common
+void print_mutual_contacts(Graph* g, const char* first, const char* second) {
+    build_graph(g);
+    NodeId a = find_number(g, first);
+    NodeId b = find_number(g, second);
+    if (a == NO_NODE || b == NO_NODE) {
+        printf("Number not found in the network\n");
+        return;
+    }
+
+    uint64_t da = degree(g, a), db = degree(g, b);
+    NodeId* common = (NodeId*)malloc((da + db + 1) * sizeof(NodeId));
+    int decode = g->packed || g->window.enabled;
+    NodeId* scratch = decode ? (NodeId*)malloc((da + db + 1) * sizeof(NodeId)) : NULL;
+    if (!common || (decode && !scratch)) {
+        printf("Error: Out of memory\n");
+        free(common);
+        return;
+    }
+    const NodeId* list_a = neighbor_list(g, a, scratch, &da);
+    const NodeId* list_b = neighbor_list(g, b, scratch ? scratch + da : NULL, &db);
+    uint64_t count = intersect_sorted(list_a, da, list_b, db, common);
+    free(scratch);
+
+    char formatted[PHONE_LENGTH];
+    printf("Mutual contacts of %s and %s: %llu\n", first, second, (unsigned long long)count);
+    for (uint64_t i = 0; i < count && i < HOP_PRINT_LIMIT; i++) {
+        format_number(g->numbers[common[i]], formatted);
+        printf("- %s\n", formatted);
+    }
+    if (count > HOP_PRINT_LIMIT) {
+        printf("  ... and %llu more\n", (unsigned long long)(count - HOP_PRINT_LIMIT));
+    }
+    free(common);
+}
+
+// Degree ordering: u ranks below v if it has fewer contacts (ties by ID)
+int ranks_below(Graph* g, NodeId u, NodeId v) {
+    uint64_t du = degree(g, u), dv = degree(g, v);
+    return du < dv || (du == dv && u < v);
+}
+
+typedef struct {
+    Graph* g;
+    const uint64_t* offsets;    // Oriented graph: only higher-ranked neighbours
+    NodeId* neighbors;
+    uint64_t* counts;           // Per-node triangle counts, updated atomically
+    uint64_t* next_chunk;       // Shared work counter
+    uint64_t max_out;           // Longest out-list, which bounds any intersection
+    uint64_t total;
+    NodeId first;
+    NodeId last;
+    int failed;
+} TriangleTask;
+
+// Keep each node's higher-ranked neighbours, still sorted by ID
+void* orient_worker(void* arg) {
+    TriangleTask* task = (TriangleTask*)arg;
+    Graph* g = task->g;
+    for (NodeId u = task->first; u < task->last; u++) {
+        uint64_t out = task->offsets[u];
+        NeighborCursor c;
+        NodeId v;
+        for (open_neighbors(g, u, &c); next_neighbor(&c, &v);) {
+            if (ranks_below(g, u, v)) task->neighbors[out++] = v;
+        }
+    }
+    return NULL;
+}
+
+// Count triangles u < v < w (in rank order) by intersecting out-lists.
+// Threads pull chunks of nodes from a shared counter to balance hubs.
+void* triangle_worker(void* arg) {
+    TriangleTask* task = (TriangleTask*)arg;
+    NodeId n = task->g->size;
+    NodeId* common = (NodeId*)malloc((task->max_out + 1) * sizeof(NodeId));
+    task->total = 0;
+    if (!common) {
+        task->failed = 1;
+        return NULL;
+    }
 
-    char query[PHONE_LENGTH];
     while (1) {
-        printf("\nEnter phone number to investigate (or 'quit' to exit): ");
-        scanf("%s", query);
-        
+        uint64_t chunk = __atomic_fetch_add(task->next_chunk, 1, __ATOMIC_RELAXED);
+        uint64_t first = chunk * TRIANGLE_CHUNK;
+        if (first >= n) break;
+        NodeId last = first + TRIANGLE_CHUNK < n ? (NodeId)(first + TRIANGLE_CHUNK) : n;
+
+        for (NodeId u = (NodeId)first; u < last; u++) {
+            const NodeId* out_u = &task->neighbors[task->offsets[u]];
+            uint64_t du = task->offsets[u + 1] - task->offsets[u];
+            for (uint64_t i = 0; i < du; i++) {
+                NodeId v = out_u[i];
+                uint64_t found = intersect_sorted(out_u, du, &task->neighbors[task->offsets[v]],
+                                                  task->offsets[v + 1] - task->offsets[v], common);
+                if (!found) continue;
+                task->total += found;
+                __atomic_fetch_add(&task->counts[u], found, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&task->counts[v], found, __ATOMIC_RELAXED);
+                for (uint64_t k = 0; k < found; k++) {
+                    __atomic_fetch_add(&task->counts[common[k]], 1, __ATOMIC_RELAXED);
+                }
+            }
+        }
+    }
+    free(common);
+    return NULL;
+}
+
+// Count every triangle once and per node. Returns the per-node counts
+// (caller frees) and stores the global count in *total; NULL on failure.
+uint64_t* count_triangles(Graph* g, uint64_t* total) {
+    NodeId n = g->size;
+    uint64_t* offsets = (uint64_t*)calloc((size_t)n + 1, sizeof(uint64_t));
+    uint64_t* counts = (uint64_t*)calloc((size_t)n + 1, sizeof(uint64_t));
+    NodeId* neighbors = (NodeId*)malloc((g->entries / 2 + 1) * sizeof(NodeId));
+    if (!offsets || !counts || !neighbors) {
+        free(offsets);
+        free(counts);
+        free(neighbors);
+        return NULL;
+    }
+
+    uint64_t max_out = 0;
+    for (NodeId u = 0; u < n; u++) {
+        uint64_t out = 0;
+        NeighborCursor c;
+        NodeId v;
+        for (open_neighbors(g, u, &c); next_neighbor(&c, &v);) {
+            out += ranks_below(g, u, v);
+        }
+        offsets[u + 1] = offsets[u] + out;
+        if (out > max_out) max_out = out;
+    }
+
+    TriangleTask tasks[MAX_THREADS];
+    NodeId first[MAX_THREADS], last[MAX_THREADS];
+    uint64_t next_chunk = 0;
+    split_ranges(g, first, last);
+    for (int t = 0; t < thread_count; t++) {
+        tasks[t] = (TriangleTask){ g, offsets, neighbors, counts, &next_chunk, max_out, 0, first[t], last[t], 0 };
+    }
+    run_parallel(orient_worker, tasks, sizeof(TriangleTask), thread_count);
+    run_parallel(triangle_worker, tasks, sizeof(TriangleTask), thread_count);
+
+    *total = 0;
+    int failed = 0;
+    for (int t = 0; t < thread_count; t++) {
+        *total += tasks[t].total;
+        failed |= tasks[t].failed;
+    }
+    free(offsets);
+    free(neighbors);
+    if (failed) {
+        // A worker without its buffer skipped its share, so the counts are short
+        free(counts);
+        return NULL;
+    }
+    return counts;
+}
+
+// Print the global triangle count and the numbers in the most triangles
+int print_triangles(Graph* g) {
+    build_graph(g);
+    double start = now_seconds();
+    uint64_t total;
+    uint64_t* counts = count_triangles(g, &total);
+    if (!counts) {
+        printf("Error: Out of memory\n");
+        return 0;
+    }
+    printf("Triangles: %llu in %.2f s\n", (unsigned long long)total, now_seconds() - start);
+
+    NodeId top[TOP_RANKED];
+    int ranked = 0;
+    for (NodeId v = 0; v < g->size; v++) {
+        if (ranked == TOP_RANKED && counts[v] <= counts[top[ranked - 1]]) continue;
+        int i = ranked < TOP_RANKED ? ranked++ : ranked - 1;
+        while (i > 0 && counts[top[i - 1]] < counts[v]) {
+            top[i] = top[i - 1];
+            i--;
+        }
+        top[i] = v;
+    }
+
+    char formatted[PHONE_LENGTH];
+    printf("Most triangles:\n");
+    for (int i = 0; i < ranked; i++) {
+        format_number(g->numbers[top[i]], formatted);
+        printf("%2d. %-17s %llu\n", i + 1, formatted, (unsigned long long)counts[top[i]]);
+    }
+    free(counts);
+    return 1;
+}
+
+// Add given connections
+void add_sample_connections(Graph* g) {
+    add_connection(g, "0781", "0782");
+    add_connection(g, "0781", "0783");
+    add_connection(g, "0782", "0784");
+    add_connection(g, "0783", "0785");
+    add_connection(g, "0784", "0785");
+    add_connection(g, "0784", "0786");
+    add_connection(g, "0785", "0787");
+    add_connection(g, "0786", "0788");
+    if (g->window.enabled) {
+        // The samples carry no call times, so date them now
+        int64_t now = (int64_t)time(NULL);
+        for (uint64_t e = 0; e < g->pending_count; e++) {
+            window_add(g, g->pending[e].from, g->pending[e].to, now);
+        }
+        g->pending_count = 0;
+    }
+    build_graph(g);
+}
+
+int main(int argc, char* argv[]) {
+    Graph g;
+    init_graph(&g);
+    const char* cdr_path = NULL;
+    const char* analysis_path = NULL;
+    int triangles = 0;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = cores < 1 ? 1 : cores > MAX_THREADS ? MAX_THREADS : (int)cores;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+            if (thread_count < 1) thread_count = 1;
+            if (thread_count > MAX_THREADS) thread_count = MAX_THREADS;
+        } else if (strcmp(argv[i], "--analyze") == 0 && i + 1 < argc) {
+            analysis_path = argv[++i];
+        } else if (strcmp(argv[i], "--triangles") == 0) {
+            triangles = 1;
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            g.compress = 1;
+        } else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            g.window.enabled = 1;
+            g.window.retention = (int64_t)(atof(argv[++i]) * SECONDS_PER_DAY);
+            if (g.window.retention < 0) g.window.retention = 0;
+        } else if (strcmp(argv[i], "--bucket") == 0 && i + 1 < argc) {
+            g.window.bucket_seconds = (int64_t)(atof(argv[++i]) * 3600);
+            if (g.window.bucket_seconds < 1) g.window.bucket_seconds = 1;
+        } else if (!cdr_path) {
+            cdr_path = argv[i];
+        } else {
+            printf("Usage: %s [--threads N] [--analyze out_file] [--triangles] [--compress] "
+                   "[--window DAYS [--bucket HOURS]] [cdr_file | -]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (g.compress && g.window.enabled) {
+        printf("Error: --compress and --window cannot be combined\n");
+        return 1;
+    }
+
+    if (cdr_path) {
+        IngestStats stats;
+        int ok = ingest_cdr(&g, cdr_path, &stats);
+        print_ingest_stats(&g, &stats);
+        if (!ok || (strcmp(cdr_path, "-") == 0 && !analysis_path && !triangles)) {
+            // stdin is used up by the records, so there is nothing left to query
+            free_graph(&g);
+            return ok ? 0 : 1;
+        }
+    } else {
+        add_sample_connections(&g);
+    }
+
+    if (analysis_path || triangles) {
+        if (g.window.enabled && !flatten_window(&g)) {
+            free_graph(&g);
+            return 1;
+        }
+        int ok = (!triangles || print_triangles(&g)) && (!analysis_path || analyze_graph(&g, analysis_path));
+        free_graph(&g);
+        return ok ? 0 : 1;
+    }
+
+    char query[PHONE_LENGTH];
+    while (1) {
+        printf("\nEnter phone number to investigate, 'hops <number> <k>', "
+               "'chain <from> <to>', 'mutual <a> <b>'%s (or 'quit' to exit): ",
+               g.window.enabled ? ", 'window <from> <to>|all'" : "");
+        if (scanf("%19s", query) != 1) break;
+
         if (strcmp(query, "quit") == 0) {
             break;
         }
+        if (strcmp(query, "hops") == 0) {
+            int k;
+            if (scanf("%19s %d", query, &k) != 2) break;
+            print_khop_contacts(&g, query, k);
+            continue;
+        }
+        if (strcmp(query, "chain") == 0) {
+            char target[PHONE_LENGTH];
+            if (scanf("%19s %19s", query, target) != 2) break;
+            print_shortest_chain(&g, query, target);
+            continue;
+        }
+        if (strcmp(query, "window") == 0 && g.window.enabled) {
+            long long from, to;
+            if (scanf("%19s", query) != 1) break;
+            if (strcmp(query, "all") == 0) {
+                g.window.query_from = INT64_MIN;
+                g.window.query_to = INT64_MAX;
+                printf("Queries cover the whole window\n");
+            } else if (sscanf(query, "%lld", &from) == 1 && scanf("%lld", &to) == 1 && from <= to) {
+                g.window.query_from = from;
+                g.window.query_to = to;
+                printf("Queries limited to calls between %lld and %lld\n", from, to);
+            } else {
+                printf("Usage: window <from> <to> | window all\n");
+            }
+            continue;
+        }
+        if (strcmp(query, "mutual") == 0) {
+            char other[PHONE_LENGTH];
+            if (scanf("%19s %19s", query, other) != 2) break;
+            print_mutual_contacts(&g, query, other);
+            continue;
+        }
 
         print_direct_contacts(&g, query);
         print_adjacency_matrix(&g);
     }
 
+    free_graph(&g);
     return 0;
 }
@@ -1,219 +1,1848 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <strings.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_mixer.h>
 
 #define MAX_PATH 512
+#define TAG_LENGTH 64
+#define ID3_READ_LIMIT 65536     // Tag bytes read for text frames; cover art past this is skipped
+#define FRAME_SCAN_BYTES 4096    // Bytes searched for the first MPEG frame header
+#define SCAN_THREADS 16          // Files stat'ed and parsed at once; hides network mount latency
+#define MAX_SCAN_DEPTH 32
+#define INDEX_FILE ".mp3index"   // Default library index, inside the music directory
+#define INDEX_HEADER "mp3player-index 2"
 #define AUDIO_FREQUENCY 44100
 #define AUDIO_CHANNELS 2
 #define AUDIO_CHUNK_SIZE 2048
+#define MAX_CHUNK_SIZE 16384
+#define UNDERRUN_LIMIT 3         // Underruns within ADAPT_WINDOW_MS that double the buffer
+#define ADAPT_WINDOW_MS 10000
+#define ADAPT_CALM_MS 60000      // Underrun-free time before the buffer shrinks back
+#define HIST_SUB_BITS 4          // Histogram precision: 16 sub-buckets per power of two
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+#define DECODE_CACHE_SLOTS 5     // Previous, current and next track plus tracks still fading out
+#define DECODE_POLL_MS 100       // How often the decoder rechecks playback without a wakeup
+#define MAX_CLIENTS 8            // Control socket connections served at once
+#define CONTROL_LINE_LENGTH 256
 
-// Node structure for doubly linked list
-typedef struct Node {
-    char filepath[MAX_PATH];
-    struct Node* prev;
-    struct Node* next;
-} Node;
+// A song in the library, with the tag data shown while it plays
+typedef struct {
+    char* filepath;
+    char title[TAG_LENGTH];
+    char artist[TAG_LENGTH];
+    char album[TAG_LENGTH];
+    int duration;            // Seconds, 0 if unknown
+    Sint64 mtime;            // File state the tags were read at (mtime in ns)
+    Sint64 size;
+} Song;
+
+// Array-backed playlist: songs in library order, played in the order
+// given by order[] so shuffling never moves the songs themselves
+typedef struct {
+    Song* songs;
+    int* order;              // Play position -> song index
+    int count;
+    int capacity;
+} Playlist;
+
+// A song decoded to PCM in the mixer's output format. chunk is NULL when
+// decoding failed, so the song is not retried.
+typedef struct {
+    int song;                // Index into playlist.songs, -1 = empty slot
+    Mix_Chunk* chunk;
+} DecodedTrack;
+
+// A track being mixed into the output, with its read position in bytes
+typedef struct {
+    int track;               // Play position in the playlist
+    Mix_Chunk* chunk;
+    Uint32 position;
+} Voice;
+
+Playlist playlist;
+char library_root[MAX_PATH];     // Music directory as scanned, without trailing '/'
+
+// HDR-style latency histogram in microseconds, updated with atomics only
+typedef struct {
+    SDL_atomic_t counts[HIST_BUCKETS];
+    SDL_atomic_t total;
+    SDL_atomic_t max;
+} Histogram;
+
+typedef struct {
+    Histogram decode_time;       // Decoding a whole track
+    Histogram switch_latency;    // play_song to the first sample of the new track
+    Histogram callback_jitter;   // Callback interval minus the buffer period
+    Histogram callback_time;     // Time spent inside the callback
+    SDL_atomic_t callbacks;
+    SDL_atomic_t underruns;      // Callbacks late enough that the device ran dry
+    SDL_atomic_t decode_stalls;  // Track ends with the next track not decoded yet
+    SDL_atomic_t resizes;
+} AudioStats;
 
 // Global variables for audio state
-Mix_Music* current_music = NULL;
-int is_playing = 0;
+int is_playing = 0;              // Shared with the audio callback, guarded by playback_lock
 int is_paused = 0;
+int audio_frequency = AUDIO_FREQUENCY;
+int audio_chunk_size = AUDIO_CHUNK_SIZE;
+int base_chunk_size = AUDIO_CHUNK_SIZE;   // Size asked for on the command line
+int audio_channels = AUDIO_CHANNELS;
+int frame_bytes = AUDIO_CHANNELS * 2;
+int crossfade_ms = 0;            // 0 = gapless cut between tracks
+Uint32 crossfade_frames = 0;
+
+// Playback state shared with the audio callback, guarded by playback_lock
+SDL_SpinLock playback_lock = 0;
+Voice playing = {-1, NULL, 0};
+Voice fading = {-1, NULL, 0};    // Previous track while crossfading out
+Voice queued = {-1, NULL, 0};    // Decoded track that follows playing
+Uint32 fade_total = 0;
+Uint32 fade_left = 0;
+int current_track = -1;          // Play position the user is on, playing or not
+int pending_start = -1;          // Track to start as soon as it is decoded
+Uint64 switch_started = 0;       // Counter value at the last play_song, 0 once it is heard
+
+// Instrumentation
+AudioStats stats;
+const char* stats_path = NULL;
+Uint64 last_callback = 0;        // Audio thread only (reset while the device is closed)
+Uint64 window_start = 0;         // Audio thread only: underrun counting for buffer sizing
+int window_underruns = 0;
+Uint64 last_underrun = 0;
+Uint64 callback_period_us = 0;
+SDL_atomic_t resize_request;     // Buffer size the main loop should switch to, 0 = none
+
+// Line input from the control socket (or piped stdin)
+typedef struct {
+    int fd;
+    char buffer[CONTROL_LINE_LENGTH];
+    size_t length;
+} Client;
+
+// Keystrokes typed after 'j'
+typedef struct {
+    int entering;
+    char digits[12];
+    int length;
+} KeyInput;
+
+// Event loop state. The audio callback and the decoder write a byte to
+// event_pipe whenever the playing track changes.
+int event_pipe[2] = {-1, -1};
+int reached_end = 0;             // Set by the callback when the last track ends
+volatile sig_atomic_t quit_requested = 0;
+struct termios saved_terminal;
+int terminal_raw = 0;
+
+// Decode-ahead cache, filled by the decoder thread and guarded by decode_lock
+DecodedTrack decoded[DECODE_CACHE_SLOTS];
+SDL_mutex* decode_lock = NULL;
+SDL_cond* decode_wake = NULL;
+SDL_mutex* device_lock = NULL;   // Held around Mix_LoadWAV and while the device is reopened
+SDL_Thread* decoder = NULL;
+int decoder_quit = 0;
+
+// Function to initialize an empty playlist
+void init_playlist(Playlist* pl) {
+    memset(pl, 0, sizeof(*pl));
+}
+
+// Function to free a playlist and its songs
+void free_playlist(Playlist* pl) {
+    for (int i = 0; i < pl->count; i++) free(pl->songs[i].filepath);
+    free(pl->songs);
+    free(pl->order);
+    init_playlist(pl);
+}
+
+// Function to add a song to the end of the playlist (amortized O(1))
+Song* append_song(Playlist* pl, const char* filepath) {
+    if (pl->count == pl->capacity) {
+        int capacity = pl->capacity ? pl->capacity * 2 : 64;
+        Song* songs = (Song*)realloc(pl->songs, capacity * sizeof(Song));
+        if (songs) pl->songs = songs;
+        int* order = (int*)realloc(pl->order, capacity * sizeof(int));
+        if (order) pl->order = order;
+        if (!songs || !order) return NULL;
+        pl->capacity = capacity;
+    }
+    Song* song = &pl->songs[pl->count];
+    memset(song, 0, sizeof(*song));
+    song->filepath = strdup(filepath);
+    if (!song->filepath) return NULL;
+    pl->order[pl->count] = pl->count;
+    pl->count++;
+    return song;
+}
+
+// Song at a play position
+Song* song_at(Playlist* pl, int position) {
+    return &pl->songs[pl->order[position]];
+}
+
+// Function to shuffle the play order (Fisher-Yates). The song at keep stays
+// at that position so playback is not interrupted.
+void shuffle_playlist(Playlist* pl, int keep) {
+    int kept = keep >= 0 ? pl->order[keep] : -1;
+    for (int i = pl->count - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int t = pl->order[i];
+        pl->order[i] = pl->order[j];
+        pl->order[j] = t;
+    }
+    for (int i = 0; kept >= 0 && i < pl->count; i++) {
+        if (pl->order[i] == kept) {
+            pl->order[i] = pl->order[keep];
+            pl->order[keep] = kept;
+            break;
+        }
+    }
+}
 
-// Function to create a new node
-Node* create_node(const char* filepath) {
-    Node* new_node = (Node*)malloc(sizeof(Node));
-    if (new_node) {
-        strncpy(new_node->filepath, filepath, MAX_PATH - 1);
-        new_node->filepath[MAX_PATH - 1] = '\0';
-        new_node->prev = NULL;
-        new_node->next = NULL;
+// Describe a song as "Artist - Title [m:ss]", or its path when untagged
+void format_song(Song* song, char* out, size_t size) {
+    int length;
+    if (song->title[0]) {
+        length = snprintf(out, size, "%s%s%s", song->artist, song->artist[0] ? " - " : "", song->title);
+    } else {
+        length = snprintf(out, size, "%s", song->filepath);
+    }
+    if (song->duration && length >= 0 && (size_t)length < size) {
+        snprintf(out + length, size - length, " [%d:%02d]", song->duration / 60, song->duration % 60);
     }
-    return new_node;
 }
 
-// Function to add a node to the end of the list
-Node* append_node(Node* head, const char* filepath) {
-    Node* new_node = create_node(filepath);
-    if (!new_node) return head;
+void print_song(Song* song) {
+    char text[MAX_PATH + 3 * TAG_LENGTH];
+    format_song(song, text, sizeof(text));
+    printf("%s\n", text);
+}
 
-    if (!head) return new_node;
+// ---- Tag and frame header parsing ----
 
-    Node* current = head;
-    while (current->next) {
-        current = current->next;
+// Append one code point to out as UTF-8, keeping room for the terminator
+void put_utf8(char* out, int* length, unsigned int c) {
+    char bytes[4];
+    int n;
+    if (c < 0x80) {
+        bytes[0] = (char)c;
+        n = 1;
+    } else if (c < 0x800) {
+        bytes[0] = (char)(0xC0 | (c >> 6));
+        bytes[1] = (char)(0x80 | (c & 0x3F));
+        n = 2;
+    } else {
+        bytes[0] = (char)(0xE0 | (c >> 12));
+        bytes[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+        bytes[2] = (char)(0x80 | (c & 0x3F));
+        n = 3;
     }
-    current->next = new_node;
-    new_node->prev = current;
-    return head;
+    if (*length + n >= TAG_LENGTH) return;
+    memcpy(out + *length, bytes, n);
+    *length += n;
+    out[*length] = '\0';
 }
 
-// Function to load songs from directory
-Node* load_songs(const char* directory) {
-    DIR* dir;
-    struct dirent* entry;
-    Node* head = NULL;
-    char filepath[MAX_PATH];
+// Copy tag text into out as UTF-8. encoding is the ID3v2 text encoding:
+// 0 Latin-1, 1 UTF-16 with byte order mark, 2 UTF-16BE, 3 UTF-8.
+void copy_tag_text(const Uint8* data, Uint32 size, int encoding, char* out) {
+    int length = 0;
+    out[0] = '\0';
+    if (encoding == 1 || encoding == 2) {
+        int little = 0;
+        if (encoding == 1 && size >= 2) {
+            little = data[0] == 0xFF && data[1] == 0xFE;
+            if ((data[0] == 0xFF && data[1] == 0xFE) || (data[0] == 0xFE && data[1] == 0xFF)) {
+                data += 2;
+                size -= 2;
+            }
+        }
+        for (Uint32 i = 0; i + 1 < size; i += 2) {
+            unsigned int c = little ? data[i] | (data[i + 1] << 8) : (data[i] << 8) | data[i + 1];
+            if (c == 0) break;
+            put_utf8(out, &length, c >= 0xD800 && c < 0xE000 ? '?' : c);
+        }
+    } else {
+        for (Uint32 i = 0; i < size && data[i]; i++) {
+            if (encoding == 3 || data[i] < 0x80) {
+                if (length + 1 >= TAG_LENGTH) break;
+                out[length++] = (char)data[i];
+                out[length] = '\0';
+            } else {
+                put_utf8(out, &length, data[i]);
+            }
+        }
+    }
+    // Tabs and newlines would break the index file; trailing spaces pad ID3v1
+    for (int i = 0; i < length; i++) {
+        if (out[i] == '\t' || out[i] == '\n' || out[i] == '\r') out[i] = ' ';
+    }
+    while (length > 0 && out[length - 1] == ' ') out[--length] = '\0';
+}
+
+Uint32 read_be32(const Uint8* p) {
+    return ((Uint32)p[0] << 24) | ((Uint32)p[1] << 16) | ((Uint32)p[2] << 8) | p[3];
+}
+
+Uint32 read_syncsafe(const Uint8* p) {
+    return ((Uint32)(p[0] & 0x7F) << 21) | ((Uint32)(p[1] & 0x7F) << 14) |
+           ((Uint32)(p[2] & 0x7F) << 7) | (p[3] & 0x7F);
+}
+
+// Read title, artist and album from an ID3v2.2/2.3/2.4 tag body
+void parse_id3v2(Song* song, const Uint8* tag, Uint32 size, int version) {
+    int id_length = version == 2 ? 3 : 4;
+    int header_length = version == 2 ? 6 : 10;
+    Uint32 pos = 0;
+    while (pos + header_length <= size && tag[pos] != 0) {
+        const Uint8* frame = tag + pos;
+        Uint32 frame_size = version == 2 ? ((Uint32)frame[3] << 16) | (frame[4] << 8) | frame[5]
+                          : version == 4 ? read_syncsafe(frame + 4) : read_be32(frame + 4);
+        pos += header_length;
+        if (frame_size == 0 || frame_size > size - pos) break;
+
+        char* field = NULL;
+        if (!memcmp(frame, "TIT2", id_length) || !memcmp(frame, "TT2", id_length)) field = song->title;
+        else if (!memcmp(frame, "TPE1", id_length) || !memcmp(frame, "TP1", id_length)) field = song->artist;
+        else if (!memcmp(frame, "TALB", id_length) || !memcmp(frame, "TAL", id_length)) field = song->album;
+        if (field) copy_tag_text(tag + pos + 1, frame_size - 1, tag[pos], field);
+        pos += frame_size;
+    }
+}
+
+// Duration from the first MPEG audio frame: the frame count in a Xing/Info
+// or VBRI header when present, otherwise the bitrate of a CBR stream
+int parse_frame_header(const Uint8* data, Uint32 length, Sint64 audio_bytes) {
+    static const int bitrates[2][16] = {
+        {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0},   // MPEG-1
+        {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},      // MPEG-2/2.5
+    };
+    static const int sample_rates[3][3] = {
+        {44100, 48000, 32000}, {22050, 24000, 16000}, {11025, 12000, 8000},
+    };
+
+    for (Uint32 i = 0; i + 4 <= length; i++) {
+        Uint32 header = read_be32(data + i);
+        int version = (header >> 19) & 3;      // 0 = 2.5, 2 = 2, 3 = 1
+        int layer = (header >> 17) & 3;        // 1 = Layer III
+        int bitrate_index = (header >> 12) & 0xF;
+        int rate_index = (header >> 10) & 3;
+        if ((header & 0xFFE00000) != 0xFFE00000 || version == 1 || layer != 1 ||
+            bitrate_index == 0 || bitrate_index == 15 || rate_index == 3) continue;
+
+        int mpeg1 = version == 3;
+        int sample_rate = sample_rates[mpeg1 ? 0 : version == 2 ? 1 : 2][rate_index];
+        int mono = ((header >> 6) & 3) == 3;
+        int samples_per_frame = mpeg1 ? 1152 : 576;
+        Uint32 side_info = mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+
+        const Uint8* xing = data + i + 4 + side_info;
+        if (i + 4 + side_info + 12 <= length && (!memcmp(xing, "Xing", 4) || !memcmp(xing, "Info", 4)) &&
+            (read_be32(xing + 4) & 1)) {
+            return (int)((Sint64)read_be32(xing + 8) * samples_per_frame / sample_rate);
+        }
+        const Uint8* vbri = data + i + 36;
+        if (i + 36 + 18 <= length && !memcmp(vbri, "VBRI", 4)) {
+            return (int)((Sint64)read_be32(vbri + 14) * samples_per_frame / sample_rate);
+        }
+        int bitrate = bitrates[mpeg1 ? 0 : 1][bitrate_index] * 1000;
+        return (int)((audio_bytes - i) * 8 / bitrate);
+    }
+    return 0;
+}
+
+// Function to read a song's tags and duration. ID3v2 wins over ID3v1 for
+// fields both provide.
+void read_metadata(Song* song) {
+    FILE* file = fopen(song->filepath, "rb");
+    if (!file) return;
+
+    Uint8 header[10];
+    Sint64 audio_start = 0;
+    Sint64 audio_end = song->size;
+    if (fread(header, 1, 10, file) == 10 && !memcmp(header, "ID3", 3)) {
+        Uint32 size = read_syncsafe(header + 6);
+        audio_start = 10 + size + ((header[5] & 0x10) ? 10 : 0);
+        Uint32 wanted = size < ID3_READ_LIMIT ? size : ID3_READ_LIMIT;
+        Uint8* tag = (Uint8*)malloc(wanted + 1);
+        if (tag && fread(tag, 1, wanted, file) == wanted) {
+            // Skip an extended header (v2.3 size excludes itself, v2.4 includes it)
+            Uint32 skip = 0;
+            if ((header[5] & 0x40) && wanted >= 4) {
+                skip = header[3] == 4 ? read_syncsafe(tag) : read_be32(tag) + 4;
+            }
+            if (skip < wanted) parse_id3v2(song, tag + skip, wanted - skip, header[3]);
+        }
+        free(tag);
+    }
+
+    Uint8 v1[128];
+    if (song->size >= 128 && fseek(file, (long)(song->size - 128), SEEK_SET) == 0 &&
+        fread(v1, 1, 128, file) == 128 && !memcmp(v1, "TAG", 3)) {
+        audio_end -= 128;
+        if (!song->title[0]) copy_tag_text(v1 + 3, 30, 0, song->title);
+        if (!song->artist[0]) copy_tag_text(v1 + 33, 30, 0, song->artist);
+        if (!song->album[0]) copy_tag_text(v1 + 63, 30, 0, song->album);
+    }
+
+    Uint8 frames[FRAME_SCAN_BYTES];
+    if (fseek(file, (long)audio_start, SEEK_SET) == 0) {
+        size_t got = fread(frames, 1, sizeof(frames), file);
+        song->duration = parse_frame_header(frames, (Uint32)got, audio_end - audio_start);
+    }
+    fclose(file);
+}
+
+// ---- Library index ----
+
+// Path of a library file below the music directory. The index is keyed on
+// this, so "music", "music/" and "./music" all find the same entries.
+const char* relative_path(const char* filepath) {
+    const char* relative = filepath + strlen(library_root);
+    while (*relative == '/') relative++;
+    return relative;
+}
+
+// Path -> entry hash over songs loaded from the index file
+typedef struct {
+    Playlist entries;
+    int* slots;              // Entry index + 1, 0 = empty
+    int slot_count;
+} LibraryIndex;
+
+Uint32 hash_path(const char* path) {
+    Uint32 hash = 2166136261u;   // FNV-1a
+    while (*path) hash = (hash ^ (Uint8)*path++) * 16777619u;
+    return hash;
+}
+
+Song* find_indexed(LibraryIndex* index, const char* path) {
+    if (!index->slot_count) return NULL;
+    for (Uint32 i = hash_path(path) & (index->slot_count - 1); index->slots[i];
+         i = (i + 1) & (index->slot_count - 1)) {
+        Song* song = &index->entries.songs[index->slots[i] - 1];
+        if (strcmp(song->filepath, path) == 0) return song;
+    }
+    return NULL;
+}
+
+void free_index(LibraryIndex* index) {
+    free_playlist(&index->entries);
+    free(index->slots);
+    index->slots = NULL;
+    index->slot_count = 0;
+}
+
+// Function to load the index written by a previous run. A missing or
+// unreadable index just means every file is read again.
+void load_index(LibraryIndex* index, const char* path) {
+    init_playlist(&index->entries);
+    index->slots = NULL;
+    index->slot_count = 0;
+
+    FILE* file = fopen(path, "r");
+    if (!file) return;
+    char line[MAX_PATH + 4 * TAG_LENGTH + 64];
+    if (!fgets(line, sizeof(line), file) || strcmp(line, INDEX_HEADER "\n") != 0) {
+        fclose(file);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        // mtime, size, duration, title, artist, album, relative path - tab separated
+        char* fields[7];
+        char* cursor = line;
+        int count = 0;
+        line[strcspn(line, "\n")] = '\0';
+        while (count < 7) {
+            fields[count++] = cursor;
+            cursor = strchr(cursor, '\t');
+            if (!cursor) break;
+            *cursor++ = '\0';
+        }
+        if (count != 7) continue;
+        Song* song = append_song(&index->entries, fields[6]);
+        if (!song) break;
+        song->mtime = strtoll(fields[0], NULL, 10);
+        song->size = strtoll(fields[1], NULL, 10);
+        song->duration = atoi(fields[2]);
+        snprintf(song->title, TAG_LENGTH, "%s", fields[3]);
+        snprintf(song->artist, TAG_LENGTH, "%s", fields[4]);
+        snprintf(song->album, TAG_LENGTH, "%s", fields[5]);
+    }
+    fclose(file);
+
+    index->slot_count = 16;
+    while (index->slot_count < 2 * index->entries.count) index->slot_count *= 2;
+    index->slots = (int*)calloc(index->slot_count, sizeof(int));
+    if (!index->slots) {
+        free_index(index);
+        return;
+    }
+    for (int e = 0; e < index->entries.count; e++) {
+        Uint32 i = hash_path(index->entries.songs[e].filepath) & (index->slot_count - 1);
+        while (index->slots[i]) i = (i + 1) & (index->slot_count - 1);
+        index->slots[i] = e + 1;
+    }
+}
 
-    dir = opendir(directory);
+// Function to save the library index. Written to a temporary file and
+// renamed, so an interrupted run never leaves a truncated index.
+void save_index(Playlist* pl, const char* path) {
+    char temp[MAX_PATH];
+    snprintf(temp, MAX_PATH, "%s.tmp", path);
+    FILE* file = fopen(temp, "w");
+    if (!file) {
+        printf("Warning: Could not write library index %s\n", path);
+        return;
+    }
+    fprintf(file, INDEX_HEADER "\n");
+    for (int i = 0; i < pl->count; i++) {
+        Song* s = &pl->songs[i];
+        fprintf(file, "%lld\t%lld\t%d\t%s\t%s\t%s\t%s\n", (long long)s->mtime, (long long)s->size,
+                s->duration, s->title, s->artist, s->album, relative_path(s->filepath));
+    }
+    if (fclose(file) != 0 || rename(temp, path) != 0) {
+        printf("Warning: Could not write library index %s\n", path);
+        remove(temp);
+    }
+}
+
+// ---- Library scan ----
+
+int has_mp3_extension(const char* name) {
+    size_t length = strlen(name);
+    return length > 4 && strcasecmp(name + length - 4, ".mp3") == 0;
+}
+
+// Function to collect MP3 files under a directory, recursively
+void scan_directory(Playlist* pl, const char* directory, int depth) {
+    DIR* dir = opendir(directory);
     if (!dir) {
         printf("Error: Could not open directory %s\n", directory);
-        return NULL;
+        return;
     }
 
+    struct dirent* entry;
+    char filepath[MAX_PATH];
     while ((entry = readdir(dir)) != NULL) {
-        if (strstr(entry->d_name, ".mp3")) {
-            snprintf(filepath, MAX_PATH, "%s/%s", directory, entry->d_name);
-            head = append_node(head, filepath);
+        if (entry->d_name[0] == '.') continue;   // ".", ".." and hidden files
+        if (snprintf(filepath, MAX_PATH, "%s/%s", directory, entry->d_name) >= MAX_PATH) continue;
+
+        int is_dir = entry->d_type == DT_DIR;
+        int is_file = entry->d_type == DT_REG;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            struct stat st;
+            if (stat(filepath, &st) != 0) continue;
+            is_dir = S_ISDIR(st.st_mode);
+            is_file = S_ISREG(st.st_mode);
+        }
+        if (is_dir && depth < MAX_SCAN_DEPTH) {
+            scan_directory(pl, filepath, depth + 1);
+        } else if (is_file && has_mp3_extension(entry->d_name)) {
+            append_song(pl, filepath);
         }
     }
-
     closedir(dir);
-    return head;
 }
 
-// Function to initialize SDL and SDL_mixer
-int init_audio() {
+typedef struct {
+    Playlist* pl;
+    LibraryIndex* index;
+    SDL_atomic_t* next;      // Next song to claim
+    int rescanned;
+} ScanTask;
+
+// Stat each song and take its tags from the index when the file is
+// unchanged, otherwise read them from the file. Songs are claimed one at a
+// time so a slow file does not hold up a whole range.
+int scan_worker(void* arg) {
+    ScanTask* task = (ScanTask*)arg;
+    int i;
+    while ((i = SDL_AtomicAdd(task->next, 1)) < task->pl->count) {
+        Song* song = &task->pl->songs[i];
+        struct stat st;
+        if (stat(song->filepath, &st) != 0) {
+            song->size = -1;   // Vanished since the directory scan
+            continue;
+        }
+        song->mtime = (Sint64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        song->size = st.st_size;
+
+        Song* cached = find_indexed(task->index, relative_path(song->filepath));
+        if (cached && cached->mtime == song->mtime && cached->size == song->size) {
+            memcpy(song->title, cached->title, TAG_LENGTH);
+            memcpy(song->artist, cached->artist, TAG_LENGTH);
+            memcpy(song->album, cached->album, TAG_LENGTH);
+            song->duration = cached->duration;
+        } else {
+            read_metadata(song);
+            task->rescanned++;
+        }
+    }
+    return 0;
+}
+
+int compare_songs(const void* a, const void* b) {
+    return strcmp(((const Song*)a)->filepath, ((const Song*)b)->filepath);
+}
+
+// Function to load the music library: scan the directory tree, reuse index
+// entries for unchanged files, read tags for new or changed ones in
+// parallel, then update the index. Songs end up sorted by path.
+int load_library(Playlist* pl, const char* directory, const char* index_path) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    init_playlist(pl);
+
+    // Spell the directory one way so file paths come out the same each run
+    while (strncmp(directory, "./", 2) == 0 && directory[2]) {
+        directory += 2;
+        while (*directory == '/') directory++;
+    }
+    snprintf(library_root, MAX_PATH, "%s", directory);
+    size_t length = strlen(library_root);
+    while (length > 1 && library_root[length - 1] == '/') library_root[--length] = '\0';
+    scan_directory(pl, library_root, 0);
+    if (pl->count == 0) return 0;
+    qsort(pl->songs, pl->count, sizeof(Song), compare_songs);
+
+    LibraryIndex index;
+    load_index(&index, index_path);
+
+    SDL_atomic_t next;
+    SDL_AtomicSet(&next, 0);
+    ScanTask tasks[SCAN_THREADS];
+    SDL_Thread* threads[SCAN_THREADS];
+    int thread_count = pl->count < SCAN_THREADS ? pl->count : SCAN_THREADS;
+    for (int t = 0; t < thread_count; t++) {
+        tasks[t].pl = pl;
+        tasks[t].index = &index;
+        tasks[t].next = &next;
+        tasks[t].rescanned = 0;
+        threads[t] = SDL_CreateThread(scan_worker, "scan", &tasks[t]);
+        if (!threads[t]) scan_worker(&tasks[t]);   // Fall back to this thread
+    }
+    int rescanned = 0;
+    for (int t = 0; t < thread_count; t++) {
+        if (threads[t]) SDL_WaitThread(threads[t], NULL);
+        rescanned += tasks[t].rescanned;
+    }
+    int indexed = index.entries.count;
+    free_index(&index);
+
+    // Drop files that vanished between the directory scan and stat
+    int kept = 0;
+    for (int i = 0; i < pl->count; i++) {
+        if (pl->songs[i].size < 0) {
+            free(pl->songs[i].filepath);
+            continue;
+        }
+        pl->songs[kept] = pl->songs[i];
+        pl->order[kept] = kept;
+        kept++;
+    }
+    pl->count = kept;
+
+    // Every song came from the index and none are missing: it is up to date
+    if (rescanned > 0 || pl->count != indexed) save_index(pl, index_path);
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    printf("Library: %d songs (%d read, %d from index) in %.2f s\n", pl->count, rescanned,
+           pl->count - rescanned, seconds);
+    return pl->count > 0;
+}
+
+// Wake the main loop. Safe from the audio callback and signal handlers.
+void notify_main() {
+    char event = 1;
+    if (write(event_pipe[1], &event, 1) < 0) {
+        // Pipe full: the main loop has a wakeup pending already
+    }
+}
+
+// ---- Instrumentation ----
+
+// Log-linear bucket: values below HIST_SUB map to themselves, and each
+// power of two above is split into HIST_SUB equal sub-buckets, so every
+// bucket is within about 6% of the values it holds
+int histogram_bucket(Uint32 value) {
+    if (value < HIST_SUB) return (int)value;
+    int msb = 31 - __builtin_clz(value);
+    int shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int)((value >> shift) - HIST_SUB);
+}
+
+// Smallest value that falls into a bucket
+Uint32 bucket_floor(int bucket) {
+    if (bucket < HIST_SUB) return (Uint32)bucket;
+    int shift = bucket / HIST_SUB - 1;
+    return (Uint32)(bucket % HIST_SUB + HIST_SUB) << shift;
+}
+
+// Record one value. Safe on the audio thread: atomic adds, no locks.
+void record_value(Histogram* h, Uint64 value) {
+    Uint32 v = value > 0xFFFFFFFFu ? 0xFFFFFFFFu : (Uint32)value;
+    SDL_AtomicAdd(&h->counts[histogram_bucket(v)], 1);
+    SDL_AtomicAdd(&h->total, 1);
+    int max;
+    do {
+        max = SDL_AtomicGet(&h->max);
+    } while ((Uint32)max < v && !SDL_AtomicCAS(&h->max, max, (int)v));
+}
+
+// Value below which the given fraction of recorded values fall
+Uint32 histogram_percentile(Histogram* h, double fraction) {
+    int total = SDL_AtomicGet(&h->total);
+    if (total == 0) return 0;
+    Sint64 rank = (Sint64)(fraction * total + 0.5);
+    if (rank < 1) rank = 1;
+    Sint64 seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += SDL_AtomicGet(&h->counts[b]);
+        if (seen >= rank) return bucket_floor(b);
+    }
+    return (Uint32)SDL_AtomicGet(&h->max);
+}
+
+Uint64 elapsed_us(Uint64 start, Uint64 end) {
+    return (Uint64)((end - start) * 1e6 / SDL_GetPerformanceFrequency());
+}
+
+void print_histogram(FILE* out, const char* name, Histogram* h) {
+    fprintf(out, "  %-22s %8d %9.2f %9.2f %9.2f %9.2f %9.2f\n", name, SDL_AtomicGet(&h->total),
+            histogram_percentile(h, 0.5) / 1000.0, histogram_percentile(h, 0.9) / 1000.0,
+            histogram_percentile(h, 0.99) / 1000.0, histogram_percentile(h, 0.999) / 1000.0,
+            (Uint32)SDL_AtomicGet(&h->max) / 1000.0);
+}
+
+// Function to print the audio pipeline report
+void write_stats(FILE* out) {
+    fprintf(out, "Audio stats (buffer %d frames, %.1f ms):\n", audio_chunk_size,
+            audio_chunk_size * 1000.0 / audio_frequency);
+    fprintf(out, "  callbacks %d, underruns %d, decode stalls %d, buffer resizes %d\n",
+            SDL_AtomicGet(&stats.callbacks), SDL_AtomicGet(&stats.underruns),
+            SDL_AtomicGet(&stats.decode_stalls), SDL_AtomicGet(&stats.resizes));
+    fprintf(out, "  %-22s %8s %9s %9s %9s %9s %9s\n", "(ms)", "count", "p50", "p90", "p99", "p99.9", "max");
+    print_histogram(out, "decode", &stats.decode_time);
+    print_histogram(out, "switch to first sample", &stats.switch_latency);
+    print_histogram(out, "callback jitter", &stats.callback_jitter);
+    print_histogram(out, "callback run time", &stats.callback_time);
+}
+
+// Function to write the report to the --stats file, if one was given
+void save_stats() {
+    if (!stats_path) return;
+    FILE* file = fopen(stats_path, "w");
+    if (!file) {
+        printf("Warning: Could not write stats file %s\n", stats_path);
+        return;
+    }
+    write_stats(file);
+    fclose(file);
+}
+
+// Audio thread: time the callback against the buffer period. A callback
+// arriving more than half a period late means the device ran dry. Too many
+// of those within ADAPT_WINDOW_MS ask the main loop for a bigger buffer;
+// a long quiet spell asks for the configured size back.
+void measure_callback(Uint64 entered) {
+    SDL_AtomicAdd(&stats.callbacks, 1);
+    if (!last_callback) {
+        window_start = last_underrun = entered;
+        window_underruns = 0;
+    } else {
+        Uint64 interval = elapsed_us(last_callback, entered);
+        record_value(&stats.callback_jitter, interval > callback_period_us ? interval - callback_period_us
+                                                                           : callback_period_us - interval);
+        if (interval > callback_period_us * 3 / 2) {
+            SDL_AtomicAdd(&stats.underruns, 1);
+            window_underruns++;
+            last_underrun = entered;
+        }
+    }
+    last_callback = entered;
+
+    if (elapsed_us(window_start, entered) >= ADAPT_WINDOW_MS * 1000) {
+        window_start = entered;
+        window_underruns = 0;
+    }
+    int request = 0;
+    if (window_underruns >= UNDERRUN_LIMIT && audio_chunk_size < MAX_CHUNK_SIZE) {
+        request = audio_chunk_size * 2;
+        window_underruns = 0;
+    } else if (elapsed_us(last_underrun, entered) >= ADAPT_CALM_MS * 1000 && audio_chunk_size > base_chunk_size) {
+        request = audio_chunk_size / 2;
+        last_underrun = entered;
+    }
+    if (request && SDL_AtomicCAS(&resize_request, 0, request)) notify_main();
+}
+
+// Add frames from a voice to the output, scaling by a linear gain ramp.
+// Frames past the end of the voice are left silent.
+void mix_voice(Voice* v, Sint16* out, Uint32 frames, float gain, float step) {
+    Uint32 available = (v->chunk->alen - v->position) / frame_bytes;
+    if (frames > available) frames = available;
+    const Sint16* in = (const Sint16*)(v->chunk->abuf + v->position);
+    for (Uint32 i = 0; i < frames * audio_channels; i++) {
+        int sample = out[i] + (int)(in[i] * (gain + step * (i / audio_channels)));
+        out[i] = sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample;
+    }
+    v->position += frames * frame_bytes;
+}
+
+// Move playback on to the queued track. With a crossfade the old track keeps
+// playing underneath for its last fade_frames frames.
+void advance_track(Uint32 fade_frames) {
+    fading = playing;
+    if (!fade_frames) fading.chunk = NULL;
+    fade_total = fade_left = fade_frames;
+    playing = queued;
+    queued.track = -1;
+    queued.chunk = NULL;
+    current_track = playing.track;
+}
+
+// Mixer callback: plays the decoded tracks back to back, so the next track
+// starts on the sample after the last one ends (or crossfades into it)
+void mix_tracks(void* udata, Uint8* stream, int len) {
+    (void)udata;
+    Uint64 entered = SDL_GetPerformanceCounter();
+    Sint16* out = (Sint16*)stream;
+    Uint32 frames = len / frame_bytes;
+    int changed = 0;
+    measure_callback(entered);
+
+    SDL_AtomicLock(&playback_lock);
+    while (!is_paused && frames > 0 && (playing.chunk || fade_left)) {
+        Uint32 left = playing.chunk ? (playing.chunk->alen - playing.position) / frame_bytes : 0;
+        if (playing.chunk && !fade_left && queued.chunk && left <= crossfade_frames) {
+            advance_track(left);
+            changed = 1;
+            continue;
+        }
+        if (playing.chunk && left == 0) {
+            if (queued.chunk) {
+                advance_track(0);
+            } else {
+                // The next track is not decoded yet (or this was the last one)
+                pending_start = playing.track + 1 < playlist.count ? playing.track + 1 : -1;
+                if (pending_start >= 0) current_track = pending_start;
+                else is_playing = 0;
+                if (pending_start >= 0) SDL_AtomicAdd(&stats.decode_stalls, 1);
+                reached_end = pending_start < 0;
+                playing.chunk = NULL;
+            }
+            changed = 1;
+            continue;
+        }
+
+        Uint32 count = frames;
+        if (playing.chunk && count > left) count = left;
+        if (fade_left) {
+            if (count > fade_left) count = fade_left;
+            float step = 1.0f / fade_total;
+            float gain = 1.0f - (float)fade_left / fade_total;
+            if (fading.chunk) mix_voice(&fading, out, count, 1.0f - gain, -step);
+            if (playing.chunk) mix_voice(&playing, out, count, gain, step);
+            fade_left -= count;
+            if (!fade_left) fading.chunk = NULL;
+        } else {
+            mix_voice(&playing, out, count, 1.0f, 0.0f);
+        }
+        out += count * audio_channels;
+        frames -= count;
+    }
+    if (switch_started && playing.chunk && playing.position > 0) {
+        record_value(&stats.switch_latency, elapsed_us(switch_started, entered));
+        switch_started = 0;
+    }
+    SDL_AtomicUnlock(&playback_lock);
+    record_value(&stats.callback_time, elapsed_us(entered, SDL_GetPerformanceCounter()));
+
+    if (changed) {
+        SDL_CondSignal(decode_wake);
+        notify_main();
+    }
+}
+
+// Find the song at a play position in the decode cache (decode_lock held)
+DecodedTrack* find_decoded(int track) {
+    if (track < 0 || track >= playlist.count) return NULL;
+    int song = playlist.order[track];
+    for (int i = 0; i < DECODE_CACHE_SLOTS; i++) {
+        if (decoded[i].song == song) return &decoded[i];
+    }
+    return NULL;
+}
+
+// Store a freshly decoded song, evicting songs that are neither wanted
+// nor still referenced by the audio callback (decode_lock held)
+void store_decoded(int song, Mix_Chunk* chunk, int wanted[], int wanted_count) {
+    DecodedTrack* slot = NULL;
+    Mix_Chunk* evicted[DECODE_CACHE_SLOTS];
+    int evicted_count = 0;
+    SDL_AtomicLock(&playback_lock);
+    for (int i = 0; i < DECODE_CACHE_SLOTS; i++) {
+        int keep = 0;
+        for (int w = 0; w < wanted_count; w++) keep |= decoded[i].song == wanted[w];
+        keep |= decoded[i].chunk && (decoded[i].chunk == playing.chunk ||
+                                     decoded[i].chunk == fading.chunk ||
+                                     decoded[i].chunk == queued.chunk);
+        if (decoded[i].song >= 0 && !keep) {
+            if (decoded[i].chunk) evicted[evicted_count++] = decoded[i].chunk;
+            decoded[i].song = -1;
+            decoded[i].chunk = NULL;
+        }
+        if (decoded[i].song < 0 && !slot) slot = &decoded[i];
+    }
+    SDL_AtomicUnlock(&playback_lock);
+
+    // Mix_FreeChunk takes the audio device lock, which the callback holds
+    // while it waits for playback_lock, so free only after unlocking
+    for (int i = 0; i < evicted_count; i++) Mix_FreeChunk(evicted[i]);
+    if (!slot) {
+        // Cannot happen with enough slots; drop the track rather than block
+        if (chunk) Mix_FreeChunk(chunk);
+        return;
+    }
+    slot->song = song;
+    slot->chunk = chunk;
+}
+
+// Hand decoded tracks to the audio callback: start a track the user is
+// waiting for, and queue the track after the playing one so the switch is
+// gapless (decode_lock held)
+void publish_decoded() {
+    SDL_AtomicLock(&playback_lock);
+    DecodedTrack* start = find_decoded(pending_start);
+    if (start) {
+        if (start->chunk) {
+            playing.track = pending_start;
+            playing.chunk = start->chunk;
+            playing.position = 0;
+            is_playing = 1;
+        }
+        pending_start = -1;
+    }
+    int after = playing.chunk ? playing.track + 1 : -1;
+    DecodedTrack* next = find_decoded(after);
+    queued.track = after;
+    queued.chunk = next ? next->chunk : NULL;
+    queued.position = 0;
+    SDL_AtomicUnlock(&playback_lock);
+}
+
+// Decoder thread: keeps the current, next and previous tracks decoded ahead
+// of time, so switching to any of them never waits on the disk
+int decode_ahead(void* data) {
+    (void)data;
+    SDL_LockMutex(decode_lock);
+    while (!decoder_quit) {
+        SDL_AtomicLock(&playback_lock);
+        int current = current_track;
+        SDL_AtomicUnlock(&playback_lock);
+
+        // Most urgent first: the track the user is on, then the one after it
+        int positions[3] = {current, current + 1, current - 1};
+        int wanted[3];
+        int missing = -1;
+        for (int w = 0; w < 3; w++) {
+            int valid = current >= 0 && positions[w] >= 0 && positions[w] < playlist.count;
+            wanted[w] = valid ? playlist.order[positions[w]] : -1;
+            if (valid && missing < 0 && !find_decoded(positions[w])) missing = wanted[w];
+        }
+        if (missing < 0) {
+            SDL_CondWaitTimeout(decode_wake, decode_lock, DECODE_POLL_MS);
+            continue;
+        }
+
+        // The song array is not modified after loading, so it is safe to
+        // read without the lock
+        SDL_UnlockMutex(decode_lock);
+        const char* filepath = playlist.songs[missing].filepath;
+        SDL_LockMutex(device_lock);
+        Uint64 started = SDL_GetPerformanceCounter();
+        Mix_Chunk* chunk = Mix_LoadWAV(filepath);
+        record_value(&stats.decode_time, elapsed_us(started, SDL_GetPerformanceCounter()));
+        SDL_UnlockMutex(device_lock);
+        if (!chunk) printf("Error loading music %s: %s\n", filepath, Mix_GetError());
+        SDL_LockMutex(decode_lock);
+
+        store_decoded(missing, chunk, wanted, 3);
+        publish_decoded();
+        notify_main();   // A track waiting for this decode may have started
+    }
+    SDL_UnlockMutex(decode_lock);
+    return 0;
+}
+
+// Function to reopen the audio device with a new buffer size. Runs on the
+// main loop; playback picks up where it was since the voices are kept.
+void resize_audio_buffer() {
+    int size = SDL_AtomicSet(&resize_request, 0);
+    if (!size || size == audio_chunk_size) return;
+
+    // Mix_LoadWAV fails without an open device, and a failed decode is
+    // never retried, so wait for a running decode and hold off the next one
+    SDL_LockMutex(device_lock);
+    Mix_HookMusic(NULL, NULL);
+    Mix_CloseAudio();
+    int frequency, channels;
+    Uint16 format;
+    if (Mix_OpenAudio(audio_frequency, MIX_DEFAULT_FORMAT, audio_channels, size) < 0 ||
+        !Mix_QuerySpec(&frequency, &format, &channels) || frequency != audio_frequency ||
+        format != AUDIO_S16SYS || channels != audio_channels) {
+        // Decoded tracks are in the old format, so it has to be the old device
+        printf("Buffer resize to %d frames failed, keeping %d\n", size, audio_chunk_size);
+        Mix_CloseAudio();
+        size = audio_chunk_size;
+        if (Mix_OpenAudio(audio_frequency, MIX_DEFAULT_FORMAT, audio_channels, size) < 0) {
+            printf("Error: Could not reopen audio: %s\n", Mix_GetError());
+            SDL_UnlockMutex(device_lock);
+            return;
+        }
+    } else {
+        printf("Audio buffer %s to %d frames\n", size > audio_chunk_size ? "grown" : "shrunk", size);
+        SDL_AtomicAdd(&stats.resizes, 1);
+    }
+    audio_chunk_size = size;
+    callback_period_us = (Uint64)size * 1000000 / audio_frequency;
+    last_callback = 0;
+    Mix_HookMusic(mix_tracks, NULL);
+    SDL_UnlockMutex(device_lock);
+}
+
+// Function to initialize SDL and SDL_mixer. Headless, only the output
+// format is set up, for decoding without playback.
+int init_audio(int headless) {
+    if (headless) {
+        // No sound card needed, but Mix_LoadWAV still wants an open device
+        SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+    }
     if (SDL_Init(SDL_INIT_AUDIO) < 0) {
         printf("SDL initialization failed: %s\n", SDL_GetError());
         return 0;
     }
 
-    if (Mix_OpenAudio(AUDIO_FREQUENCY, MIX_DEFAULT_FORMAT, AUDIO_CHANNELS, AUDIO_CHUNK_SIZE) < 0) {
+    if (Mix_OpenAudio(AUDIO_FREQUENCY, MIX_DEFAULT_FORMAT, AUDIO_CHANNELS, audio_chunk_size) < 0) {
         printf("SDL_mixer initialization failed: %s\n", Mix_GetError());
         return 0;
     }
 
-    return 1;
-}
-
-// Function to play a song
-void play_song(const char* filepath) {
-    if (current_music) {
-        Mix_FreeMusic(current_music);
+    // Decoded chunks are converted to the device format, which may have
+    // a different rate or channel count than requested
+    Uint16 format;
+    Mix_QuerySpec(&audio_frequency, &format, &audio_channels);
+    if (format != AUDIO_S16SYS) {
+        printf("SDL_mixer initialization failed: unsupported sample format\n");
+        return 0;
     }
+    frame_bytes = audio_channels * 2;
+    crossfade_frames = (Uint32)crossfade_ms * audio_frequency / 1000;
+    callback_period_us = (Uint64)audio_chunk_size * 1000000 / audio_frequency;
+    if (headless) return 1;
 
-    current_music = Mix_LoadMUS(filepath);
-    if (!current_music) {
-        printf("Error loading music: %s\n", Mix_GetError());
-        return;
+    for (int i = 0; i < DECODE_CACHE_SLOTS; i++) {
+        decoded[i].song = -1;
+        decoded[i].chunk = NULL;
+    }
+    if (pipe(event_pipe) != 0) {
+        printf("Event pipe failed: %s\n", strerror(errno));
+        return 0;
     }
+    fcntl(event_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(event_pipe[1], F_SETFL, O_NONBLOCK);
 
-    if (Mix_PlayMusic(current_music, 1) == -1) {
-        printf("Error playing music: %s\n", Mix_GetError());
-        return;
+    decode_lock = SDL_CreateMutex();
+    decode_wake = SDL_CreateCond();
+    device_lock = SDL_CreateMutex();
+    decoder = decode_lock && decode_wake && device_lock ? SDL_CreateThread(decode_ahead, "decoder", NULL) : NULL;
+    if (!decoder) {
+        printf("Decoder thread failed: %s\n", SDL_GetError());
+        return 0;
     }
 
-    is_playing = 1;
+    Mix_HookMusic(mix_tracks, NULL);
+    return 1;
+}
+
+// Function to play a song. Starts at once if the track was decoded ahead,
+// otherwise as soon as the decoder thread has it.
+void play_song(int position) {
+    SDL_LockMutex(decode_lock);
+    DecodedTrack* track = find_decoded(position);
+
+    SDL_AtomicLock(&playback_lock);
+    fading = playing;
+    if (!playing.chunk || !crossfade_frames) fading.chunk = NULL;
+    fade_total = fade_left = fading.chunk ? crossfade_frames : 0;
+    playing.track = position;
+    playing.chunk = track ? track->chunk : NULL;
+    playing.position = 0;
+    queued.chunk = NULL;
+    current_track = position;
+    pending_start = track ? -1 : position;
+    switch_started = SDL_GetPerformanceCounter();
+    is_playing = track == NULL || track->chunk != NULL;
     is_paused = 0;
-    printf("Now playing: %s\n", filepath);
+    SDL_AtomicUnlock(&playback_lock);
+
+    if (track) publish_decoded();
+    SDL_CondSignal(decode_wake);
+    SDL_UnlockMutex(decode_lock);
+    notify_main();
+
+    if (track && !track->chunk) {
+        printf("Error loading music: %s\n", song_at(&playlist, position)->filepath);
+    } else if (!track) {
+        printf("Loading: ");
+        print_song(song_at(&playlist, position));
+    }
 }
 
-// Function to handle user commands
-void handle_command(char cmd, Node** current) {
+// Function to handle user commands. number is the track for 'j'.
+// Returns 0 if the command was invalid or could not be carried out.
+int handle_command(char cmd, int number) {
+    // Gapless playback moves on to the next track by itself
+    SDL_AtomicLock(&playback_lock);
+    int current = current_track;
+    SDL_AtomicUnlock(&playback_lock);
+
     switch (cmd) {
         case 'n':
-            if ((*current)->next) {
-                *current = (*current)->next;
-                play_song((*current)->filepath);
+            if (current + 1 < playlist.count) {
+                play_song(current + 1);
             } else {
                 printf("End of playlist reached\n");
+                return 0;
             }
             break;
 
         case 'p':
-            if ((*current)->prev) {
-                *current = (*current)->prev;
-                play_song((*current)->filepath);
+            if (current > 0) {
+                play_song(current - 1);
             } else {
                 printf("Start of playlist reached\n");
+                return 0;
             }
             break;
 
-        case ' ':  // Space for pause/resume
-            if (is_playing && !is_paused) {
-                Mix_PauseMusic();
-                is_paused = 1;
-                printf("Music paused\n");
-            } else if (is_paused) {
-                Mix_ResumeMusic();
-                is_paused = 0;
+        case 'j':  // Jump to a track number
+            if (number >= 1 && number <= playlist.count) {
+                play_song(number - 1);
+            } else {
+                printf("Track number must be between 1 and %d\n", playlist.count);
+                return 0;
+            }
+            break;
+
+        case 'r':  // Shuffle
+            SDL_LockMutex(decode_lock);
+            shuffle_playlist(&playlist, current);
+            publish_decoded();   // The queued next track has changed
+            SDL_CondSignal(decode_wake);
+            SDL_UnlockMutex(decode_lock);
+            printf("Playlist shuffled\n");
+            break;
+
+        case ' ': {  // Space for pause/resume, or play after a stop
+            SDL_AtomicLock(&playback_lock);
+            int was_paused = is_paused;
+            int was_playing = is_playing;
+            if (was_playing || was_paused) is_paused = !was_paused;
+            SDL_AtomicUnlock(&playback_lock);
+            if (was_paused) {
                 printf("Music resumed\n");
+            } else if (was_playing) {
+                printf("Music paused\n");
+            } else if (current >= 0) {
+                play_song(current);
             }
             break;
+        }
 
         case 's':  // Stop
-            Mix_HaltMusic();
+            SDL_AtomicLock(&playback_lock);
+            playing.chunk = NULL;
+            fading.chunk = NULL;
+            fade_left = 0;
+            pending_start = -1;
             is_playing = 0;
             is_paused = 0;
+            SDL_AtomicUnlock(&playback_lock);
+            notify_main();
             printf("Music stopped\n");
             break;
 
+        case 'i':  // Instrumentation report
+            write_stats(stdout);
+            save_stats();
+            break;
+
         case 'q':  // Quit
             break;
 
         default:
             printf("Invalid command\n");
+            return 0;
+    }
+    return 1;
+}
+
+// Function to switch the terminal to raw input, so keys arrive without Enter
+void set_raw_terminal() {
+    struct termios raw;
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved_terminal) != 0) return;
+    raw = saved_terminal;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0) terminal_raw = 1;
+}
+
+void restore_terminal() {
+    if (terminal_raw) tcsetattr(STDIN_FILENO, TCSANOW, &saved_terminal);
+    terminal_raw = 0;
+}
+
+void handle_signal(int signal_number) {
+    (void)signal_number;
+    quit_requested = 1;
+    notify_main();
+}
+
+// Function to open the control socket. Returns the listening descriptor,
+// or -1 if the socket could not be created.
+int open_control_socket(const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("Error: Control socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        printf("Error: Could not create control socket: %s\n", strerror(errno));
+        return -1;
+    }
+    unlink(path);   // Left behind by a player that did not exit cleanly
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, MAX_CLIENTS) != 0) {
+        printf("Error: Could not listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+// Function to describe the player state for the status command
+void format_status(char* reply, size_t size) {
+    SDL_AtomicLock(&playback_lock);
+    int track = current_track;
+    int loading = pending_start >= 0;
+    int paused = is_paused, playing_now = is_playing;
+    SDL_AtomicUnlock(&playback_lock);
+
+    const char* state = paused ? "paused" : loading ? "loading" : playing_now ? "playing" : "stopped";
+    if (track < 0) {
+        snprintf(reply, size, "ok %s\n", state);
+        return;
+    }
+    char song[MAX_PATH + 3 * TAG_LENGTH];
+    format_song(song_at(&playlist, track), song, sizeof(song));
+    snprintf(reply, size, "ok %s %d/%d %s\n", state, track + 1, playlist.count, song);
+}
+
+// Function to run one line command from the control socket or piped
+// stdin. Words ("next", "jump 12") and the single keys are both accepted.
+// Writes the reply into reply; returns 0 when the player should quit.
+int run_line(const char* line, char* reply, size_t size) {
+    char word[32] = "";
+    int number = 0;
+    if (strcmp(line, " ") == 0) strcpy(word, " ");
+    else sscanf(line, "%31s %d", word, &number);
+
+    SDL_AtomicLock(&playback_lock);
+    int active = is_playing && !is_paused;
+    int paused = is_paused;
+    SDL_AtomicUnlock(&playback_lock);
+
+    char key = 0;
+    if (strlen(word) == 1) key = word[0];
+    else if (strcmp(word, "next") == 0) key = 'n';
+    else if (strcmp(word, "prev") == 0) key = 'p';
+    else if (strcmp(word, "jump") == 0) key = 'j';
+    else if (strcmp(word, "shuffle") == 0) key = 'r';
+    else if (strcmp(word, "toggle") == 0) key = ' ';
+    else if (strcmp(word, "stop") == 0) key = 's';
+    else if (strcmp(word, "quit") == 0) key = 'q';
+    else if (strcmp(word, "play") == 0) key = active ? 0 : ' ';
+    else if (strcmp(word, "pause") == 0) key = active ? ' ' : 0;
+    else if (strcmp(word, "resume") == 0) key = paused ? ' ' : 0;
+    else if (strcmp(word, "status") == 0) {
+        format_status(reply, size);
+        return 1;
+    } else if (strcmp(word, "stats") == 0) {
+        save_stats();
+        snprintf(reply, size, "ok buffer=%d underruns=%d decode_stalls=%d decode_p99_ms=%.2f "
+                 "switch_p99_ms=%.2f jitter_p99_ms=%.2f\n", audio_chunk_size,
+                 SDL_AtomicGet(&stats.underruns), SDL_AtomicGet(&stats.decode_stalls),
+                 histogram_percentile(&stats.decode_time, 0.99) / 1000.0,
+                 histogram_percentile(&stats.switch_latency, 0.99) / 1000.0,
+                 histogram_percentile(&stats.callback_jitter, 0.99) / 1000.0);
+        return 1;
+    } else if (word[0] == '\0') {
+        reply[0] = '\0';   // Blank line
+        return 1;
+    } else {
+        snprintf(reply, size, "error unknown command %s\n", word);
+        return 1;
+    }
+
+    // play/pause/resume in the state they ask for are no-ops
+    int ok = key ? handle_command(key, number) : 1;
+    snprintf(reply, size, ok ? "ok\n" : "error %s\n", word);
+    return key != 'q';
+}
+
+// Split buffered input into lines and run them. Returns 0 on quit.
+int run_buffered_lines(Client* client) {
+    char reply[MAX_PATH + 4 * TAG_LENGTH];
+    char* start = client->buffer;
+    char* end;
+    int running = 1;
+    while (running && (end = memchr(start, '\n', client->length - (start - client->buffer)))) {
+        *end = '\0';
+        if (end > start && end[-1] == '\r') end[-1] = '\0';
+        running = run_line(start, reply, sizeof(reply));
+        if (client->fd != STDIN_FILENO && reply[0]) send(client->fd, reply, strlen(reply), MSG_NOSIGNAL);
+        start = end + 1;
+    }
+    client->length -= start - client->buffer;
+    memmove(client->buffer, start, client->length);
+    if (client->length == sizeof(client->buffer)) client->length = 0;   // Overlong line
+    return running;
+}
+
+// Read from a line-based source. Returns 0 at end of input or on error.
+int read_lines(Client* client, int* running) {
+    ssize_t got = read(client->fd, client->buffer + client->length, sizeof(client->buffer) - client->length);
+    if (got <= 0) {
+        if (got < 0 && (errno == EAGAIN || errno == EINTR)) return 1;
+        // A final line without a newline still counts
+        if (client->length < sizeof(client->buffer)) client->buffer[client->length++] = '\n';
+        *running = run_buffered_lines(client);
+        return 0;
+    }
+    client->length += got;
+    *running = run_buffered_lines(client);
+    return 1;
+}
+
+// Handle raw keystrokes. Keys act at once; 'j' collects a track number up
+// to Enter. Clears *running on quit. Returns 0 at end of input or on error.
+int read_keys(KeyInput* input, int* running) {
+    char keys[64];
+    ssize_t got = read(STDIN_FILENO, keys, sizeof(keys));
+    if (got <= 0) return got < 0 && (errno == EAGAIN || errno == EINTR);
+
+    for (ssize_t i = 0; i < got; i++) {
+        char key = keys[i];
+        if (input->entering) {
+            if (key >= '0' && key <= '9' && input->length < (int)sizeof(input->digits) - 1) {
+                input->digits[input->length++] = key;
+                printf("%c", key);
+                fflush(stdout);
+                continue;
+            }
+            printf("\n");
+            input->entering = 0;
+            input->digits[input->length] = '\0';
+            if (key == '\n' || key == '\r') handle_command('j', atoi(input->digits));
+            continue;
+        }
+        if (key == 'q') {
+            *running = 0;
+            return 1;
+        }
+        if (key == 'j') {
+            input->entering = 1;
+            input->length = 0;
+            printf("Jump to track: ");
+            fflush(stdout);
+        } else if (key != '\n' && key != '\r') {
+            handle_command(key, 0);
+        }
     }
+    return 1;
+}
+
+// Report playback changes made by the audio callback or the decoder
+void announce_changes(int* announced) {
+    char drain[64];
+    while (read(event_pipe[0], drain, sizeof(drain)) > 0) {}
+
+    SDL_AtomicLock(&playback_lock);
+    int now_playing = playing.chunk ? playing.track : -1;
+    int ended = reached_end;
+    reached_end = 0;
+    SDL_AtomicUnlock(&playback_lock);
+
+    if (now_playing >= 0 && now_playing != *announced) {
+        printf("Now playing %d/%d: ", now_playing + 1, playlist.count);
+        print_song(song_at(&playlist, now_playing));
+    }
+    if (ended) printf("End of playlist reached\n");
+    *announced = now_playing;
+
+    if (SDL_AtomicGet(&resize_request)) resize_audio_buffer();
+}
+
+// Main loop: sleeps in poll() until a key, a control connection or a
+// playback event arrives, and handles it straight away
+void run_event_loop(int listener) {
+    Client clients[MAX_CLIENTS];
+    Client piped = {STDIN_FILENO, "", 0};
+    KeyInput keys = {0, "", 0};
+    int client_count = 0;
+    int stdin_open = 1;
+    int announced = -1;
+    int running = 1;
+
+    while (running && !quit_requested) {
+        struct pollfd fds[3 + MAX_CLIENTS];
+        fds[0].fd = event_pipe[0];
+        fds[1].fd = stdin_open ? STDIN_FILENO : -1;   // Negative descriptors are ignored
+        fds[2].fd = listener;
+        for (int i = 0; i < client_count; i++) fds[3 + i].fd = clients[i].fd;
+        for (int i = 0; i < 3 + client_count; i++) fds[i].events = POLLIN;
+
+        if (poll(fds, 3 + client_count, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (fds[0].revents) announce_changes(&announced);
+        if (fds[1].revents) {
+            // At end of input stop polling stdin and keep serving the socket
+            stdin_open = terminal_raw ? read_keys(&keys, &running) : read_lines(&piped, &running);
+            // Without a control socket there is nothing left to listen to
+            if (!stdin_open && listener < 0) running = 0;
+        }
+        int polled_clients = client_count;   // Clients accepted below were not polled yet
+        if (fds[2].revents) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd >= 0 && client_count == MAX_CLIENTS) {
+                send(fd, "error busy\n", 11, MSG_NOSIGNAL);
+                close(fd);
+            } else if (fd >= 0) {
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                clients[client_count].fd = fd;
+                clients[client_count].length = 0;
+                client_count++;
+            }
+        }
+        for (int i = 3 + polled_clients - 1; i >= 3 && running; i--) {
+            if (!fds[i].revents) continue;
+            if (!read_lines(&clients[i - 3], &running)) {
+                close(clients[i - 3].fd);
+                clients[i - 3] = clients[--client_count];
+            }
+        }
+    }
+
+    for (int i = 0; i < client_count; i++) close(clients[i].fd);
 }
 
 // Function to cleanup resources
-void cleanup(Node* head) {
-    while (head) {
-        Node* temp = head;
-        head = head->next;
-        free(temp);
+void cleanup() {
+    Mix_HookMusic(NULL, NULL);
+    if (decoder) {
+        SDL_LockMutex(decode_lock);
+        decoder_quit = 1;
+        SDL_CondSignal(decode_wake);
+        SDL_UnlockMutex(decode_lock);
+        SDL_WaitThread(decoder, NULL);
+    }
+    for (int i = 0; i < DECODE_CACHE_SLOTS; i++) {
+        if (decoded[i].chunk) Mix_FreeChunk(decoded[i].chunk);
+    }
+    if (decode_wake) SDL_DestroyCond(decode_wake);
+    if (device_lock) SDL_DestroyMutex(device_lock);
+    if (decode_lock) SDL_DestroyMutex(decode_lock);
+    if (event_pipe[0] >= 0) close(event_pipe[0]);
+    if (event_pipe[1] >= 0) close(event_pipe[1]);
+
+    free_playlist(&playlist);
+    Mix_CloseAudio();
+    SDL_Quit();
+}
+
+// ---- Batch decode ----
+
+// Batch decoding runs in worker processes, each with its own SDL_mixer,
+// because SDL_mixer does not promise that Mix_LoadWAV is thread-safe.
+// Workers claim songs from a counter in shared memory and send a record
+// per step to the parent, which prints and totals them.
+typedef struct {
+    const char* output;      // Directory for WAV files, NULL to only decode
+    int normalize;
+    double target_db;        // RMS level to normalize to, in dBFS
+    SDL_atomic_t* next;      // Next song to claim, shared by all workers
+    int report;              // Pipe to the parent
+} BatchTask;
+
+typedef enum { BATCH_DECODED, BATCH_DONE } BatchStep;
+
+// Sent through the pipe; small enough that writes never interleave
+typedef struct {
+    BatchStep step;
+    int song;
+    int ok;
+    double seconds;          // Time in Mix_LoadWAV
+    double audio_seconds;
+    double gain_db;
+    Sint64 pcm_bytes;        // Held from BATCH_DECODED until BATCH_DONE
+} BatchRecord;
+
+void put_le16(Uint8* p, Uint32 value) {
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+}
+
+void put_le32(Uint8* p, Uint32 value) {
+    put_le16(p, value & 0xFFFF);
+    put_le16(p + 2, value >> 16);
+}
+
+// Function to create the directories leading up to a file
+void make_parent_dirs(char* filepath) {
+    for (char* p = filepath + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        mkdir(filepath, 0755);   // Usually exists already
+        *p = '/';
+    }
+}
+
+// Function to write 16-bit PCM as a WAV file
+int write_wav(const char* filepath, Mix_Chunk* chunk) {
+    FILE* file = fopen(filepath, "wb");
+    if (!file) {
+        printf("Error: Could not create %s\n", filepath);
+        return 0;
+    }
+    Uint8 header[44];
+    memcpy(header, "RIFF", 4);
+    put_le32(header + 4, 36 + chunk->alen);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_le32(header + 16, 16);
+    put_le16(header + 20, 1);   // Integer PCM
+    put_le16(header + 22, audio_channels);
+    put_le32(header + 24, audio_frequency);
+    put_le32(header + 28, audio_frequency * frame_bytes);
+    put_le16(header + 32, frame_bytes);
+    put_le16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    put_le32(header + 40, chunk->alen);
+
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+    Sint16* samples = (Sint16*)chunk->abuf;
+    for (Uint32 i = 0; i < chunk->alen / 2; i++) samples[i] = SDL_SwapLE16(samples[i]);
+#endif
+    int ok = fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+             fwrite(chunk->abuf, 1, chunk->alen, file) == chunk->alen;
+    if (fclose(file) != 0) ok = 0;
+    if (!ok) printf("Error: Could not write %s\n", filepath);
+    return ok;
+}
+
+// Function to scale a track so its RMS level hits target_db, limited so
+// the loudest sample does not clip. Returns the gain applied in dB.
+double normalize_pcm(Mix_Chunk* chunk, double target_db) {
+    Sint16* samples = (Sint16*)chunk->abuf;
+    Uint32 count = chunk->alen / 2;
+    double sum = 0;
+    int peak = 0;
+    for (Uint32 i = 0; i < count; i++) {
+        int s = samples[i];
+        sum += (double)s * s;
+        if (abs(s) > peak) peak = abs(s);
     }
+    if (count == 0 || peak == 0) return 0;   // Silence stays silent
 
-    if (current_music) {
-        Mix_FreeMusic(current_music);
+    double rms = sqrt(sum / count) / 32768.0;
+    double gain = pow(10.0, target_db / 20.0) / rms;
+    if (gain * peak > 32767.0) gain = 32767.0 / peak;
+    for (Uint32 i = 0; i < count; i++) {
+        long s = lrint(samples[i] * gain);
+        samples[i] = (Sint16)(s > 32767 ? 32767 : s < -32768 ? -32768 : s);
+    }
+    return 20.0 * log10(gain);
+}
+
+void send_record(BatchTask* task, BatchRecord* record) {
+    if (write(task->report, record, sizeof(*record)) != (ssize_t)sizeof(*record)) {
+        printf("Error: Could not report to the parent: %s\n", strerror(errno));
+    }
+}
+
+// Worker process: claim songs until none are left, decode, optionally
+// normalize and write each one. Returns the process exit status.
+int batch_worker(BatchTask* task) {
+    if (!init_audio(1)) return 1;
+    int i;
+    while ((i = SDL_AtomicAdd(task->next, 1)) < playlist.count) {
+        Song* song = &playlist.songs[i];
+        BatchRecord record = {BATCH_DECODED, i, 0, 0, 0, 0, 0};
+        Uint64 started = SDL_GetPerformanceCounter();
+        Mix_Chunk* chunk = Mix_LoadWAV(song->filepath);
+        record.seconds = (double)(SDL_GetPerformanceCounter() - started) / SDL_GetPerformanceFrequency();
+        if (!chunk) {
+            printf("Error: Could not decode %s: %s\n", song->filepath, Mix_GetError());
+            fflush(stdout);
+            record.step = BATCH_DONE;
+            send_record(task, &record);
+            continue;
+        }
+        record.pcm_bytes = chunk->alen;
+        record.audio_seconds = (double)chunk->alen / frame_bytes / audio_frequency;
+        send_record(task, &record);
+
+        if (task->normalize) record.gain_db = normalize_pcm(chunk, task->target_db);
+        record.ok = 1;
+        if (task->output) {
+            char outpath[MAX_PATH];
+            int length = snprintf(outpath, MAX_PATH, "%s/%s", task->output, relative_path(song->filepath));
+            if (length >= MAX_PATH) {
+                printf("Error: Output path too long for %s\n", song->filepath);
+                record.ok = 0;
+            } else {
+                memcpy(outpath + length - 4, ".wav", 4);   // Replaces ".mp3"
+                make_parent_dirs(outpath);
+                record.ok = write_wav(outpath, chunk);
+            }
+            fflush(stdout);
+        }
+        Mix_FreeChunk(chunk);
+        record.step = BATCH_DONE;
+        send_record(task, &record);
     }
     Mix_CloseAudio();
     SDL_Quit();
+    return 0;
+}
+
+// Function to decode the whole library in jobs worker processes, without
+// playing anything, and print throughput totals. Returns 1 if every file
+// worked.
+int run_batch(const char* output, int jobs, int normalize, double target_db) {
+    if (output && mkdir(output, 0755) != 0 && errno != EEXIST) {
+        printf("Error: Could not create directory %s: %s\n", output, strerror(errno));
+        return 0;
+    }
+    SDL_atomic_t* next = (SDL_atomic_t*)mmap(NULL, sizeof(SDL_atomic_t), PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    int report[2];
+    if (next == MAP_FAILED || pipe(report) != 0) {
+        printf("Error: Could not set up workers: %s\n", strerror(errno));
+        if (next != MAP_FAILED) munmap(next, sizeof(SDL_atomic_t));
+        return 0;
+    }
+    SDL_AtomicSet(next, 0);
+    BatchTask task = {output, normalize, target_db, next, report[1]};
+
+    if (jobs > playlist.count) jobs = playlist.count;
+    printf("Decoding %d songs in %d processes\n", playlist.count, jobs);
+    printf("%12s %7s %10s%s  %s\n", "input", "speed", "PCM", normalize ? "      gain" : "", "file");
+    fflush(stdout);   // Or the workers inherit and repeat the buffered text
+    Uint64 start = SDL_GetPerformanceCounter();
+    int started = 0;
+    for (int w = 0; w < jobs; w++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(report[0]);
+            int status = batch_worker(&task);
+            fflush(stdout);
+            _exit(status);
+        }
+        if (pid < 0) {
+            printf("Error: Could not start worker: %s\n", strerror(errno));
+            break;
+        }
+        started++;
+    }
+    close(report[1]);
+
+    int decoded = 0;
+    Sint64 input_bytes = 0, pcm_bytes = 0, live_bytes = 0, peak_bytes = 0;
+    double decode_seconds = 0, audio_seconds = 0;
+    BatchRecord record;
+    while (read(report[0], &record, sizeof(record)) == (ssize_t)sizeof(record)) {
+        Song* song = &playlist.songs[record.song];
+        if (record.step == BATCH_DECODED) {
+            live_bytes += record.pcm_bytes;
+            if (live_bytes > peak_bytes) peak_bytes = live_bytes;
+            continue;
+        }
+        live_bytes -= record.pcm_bytes;
+        if (!record.ok) continue;
+
+        char gain_text[32] = "";
+        if (normalize) snprintf(gain_text, sizeof(gain_text), " %+6.1f dB", record.gain_db);
+        printf("%7.1f MB/s %6.0fx %7.1f MB%s  %s\n", song->size / 1e6 / record.seconds,
+               record.audio_seconds / record.seconds, record.pcm_bytes / 1e6, gain_text, song->filepath);
+        decoded++;
+        input_bytes += song->size;
+        pcm_bytes += record.pcm_bytes;
+        decode_seconds += record.seconds;
+        audio_seconds += record.audio_seconds;
+    }
+    close(report[0]);
+    for (int w = 0; w < started; w++) wait(NULL);
+    munmap(next, sizeof(SDL_atomic_t));
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+    // Wall-clock rates are what the machine does with every worker busy;
+    // the per-worker rate is one core's worth
+    int failed = playlist.count - decoded;
+    printf("\n%d decoded, %d failed in %.2f s with %d processes\n", decoded, failed, seconds, started);
+    printf("Input:  %.1f MB, %.1f MB/s total, %.1f MB/s per process\n", input_bytes / 1e6,
+           input_bytes / 1e6 / seconds, decode_seconds > 0 ? input_bytes / 1e6 / decode_seconds : 0.0);
+    printf("PCM:    %.1f MB, %.1f MB/s, %.0f s of audio, %.0fx real time total, %.0fx per process\n",
+           pcm_bytes / 1e6, pcm_bytes / 1e6 / seconds, audio_seconds, audio_seconds / seconds,
+           decode_seconds > 0 ? audio_seconds / decode_seconds : 0.0);
+    printf("Memory: %.1f MB per file on average, %.1f MB peak across processes\n",
+           decoded ? pcm_bytes / 1e6 / decoded : 0.0, peak_bytes / 1e6);
+    return failed == 0;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        printf("Usage: %s <music_directory>\n", argv[0]);
+    const char* directory = NULL;
+    const char* index_path = NULL;
+    const char* socket_path = NULL;
+    const char* decode_output = NULL;
+    int batch = 0;
+    int jobs = 0;
+    int normalize = 0;
+    double target_db = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--crossfade") == 0 && i + 1 < argc) {
+            crossfade_ms = atoi(argv[++i]);
+            if (crossfade_ms < 0) crossfade_ms = 0;
+        } else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc) {
+            index_path = argv[++i];
+        } else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            stats_path = argv[++i];
+        } else if (strcmp(argv[i], "--buffer") == 0 && i + 1 < argc) {
+            audio_chunk_size = atoi(argv[++i]);
+            if (audio_chunk_size < 256) audio_chunk_size = 256;
+            if (audio_chunk_size > MAX_CHUNK_SIZE) audio_chunk_size = MAX_CHUNK_SIZE;
+            base_chunk_size = audio_chunk_size;
+        } else if (strcmp(argv[i], "--decode") == 0 && i + 1 < argc) {
+            decode_output = argv[++i];
+            batch = 1;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            batch = 1;
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--normalize") == 0 && i + 1 < argc) {
+            target_db = atof(argv[++i]);
+            normalize = 1;
+        } else if (!directory) {
+            directory = argv[i];
+        } else {
+            directory = NULL;
+            break;
+        }
+    }
+    if (!directory) {
+        printf("Usage: %s [--crossfade ms] [--index file] [--socket path]\n"
+               "       [--buffer frames] [--stats file] <music_directory>\n"
+               "       %s --decode outdir | --bench [--jobs n] [--normalize dBFS]\n"
+               "       [--index file] <music_directory>\n", argv[0], argv[0]);
         return 1;
     }
 
     // Initialize audio
-    if (!init_audio()) {
+    // Batch workers open their own audio; the parent keeps no audio or
+    // decoder thread running, so it can fork them safely
+    if (!batch && !init_audio(0)) {
         return 1;
     }
 
-    // Load songs into doubly linked list
-    Node* head = load_songs(argv[1]);
-    if (!head) {
+    // Load songs into the playlist
+    char default_index[MAX_PATH];
+    if (!index_path) {
+        snprintf(default_index, MAX_PATH, "%s/%s", directory, INDEX_FILE);
+        index_path = default_index;
+    }
+    srand((unsigned int)SDL_GetPerformanceCounter());
+    if (!load_library(&playlist, directory, index_path)) {
         printf("No MP3 files found in directory\n");
-        cleanup(head);
+        cleanup();
         return 1;
     }
 
+    if (batch) {
+        if (jobs < 1) jobs = SDL_GetCPUCount();
+        int ok = run_batch(decode_output, jobs, normalize, target_db);
+        cleanup();
+        return ok ? 0 : 1;
+    }
+
+    int listener = socket_path ? open_control_socket(socket_path) : -1;
+    if (socket_path && listener < 0) {
+        cleanup();
+        return 1;
+    }
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
     // Start with first song
-    Node* current = head;
-    play_song(current->filepath);
+    play_song(0);
 
     // Main control loop
     printf("\nControls:\n");
     printf("n - Next song\n");
     printf("p - Previous song\n");
+    printf("j <number> - Jump to track\n");
+    printf("r - Shuffle\n");
     printf("Space - Pause/Resume\n");
     printf("s - Stop\n");
+    printf("i - Audio stats\n");
     printf("q - Quit\n");
 
-    char cmd;
-    while (1) {
-        cmd = getchar();
-        if (cmd == 'q') break;
-        if (cmd == '\n') continue;
-        handle_command(cmd, &current);
-    }
+    set_raw_terminal();
+    run_event_loop(listener);
+    restore_terminal();
 
     // Cleanup
-    cleanup(head);
+    save_stats();
+    if (listener >= 0) {
+        close(listener);
+        unlink(socket_path);
+    }
+    cleanup();
     return 0;
 }
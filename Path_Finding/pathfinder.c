@@ -2,30 +2,168 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
-#define MAX_CITIES 20
 #define MAX_NAME 50
 #define INF INT_MAX
 
+#define CACHE_SHARDS 8              // Must be a power of two
+#define CACHE_SHARD_CAPACITY 64     // Max entries per shard before LRU eviction
+#define CACHE_SHARD_BUCKETS 128     // Hash buckets per shard
+
+#define ALT_LANDMARKS 4             // Landmarks used for ALT lower bounds
+
+typedef enum {
+    SEARCH_DIJKSTRA = 0,    // Reference O(V^2) Dijkstra using min_distance
+    SEARCH_HEAP,            // Binary-heap Dijkstra
+    SEARCH_BIDIRECTIONAL,   // Binary-heap Dijkstra from both ends
+    SEARCH_ALT,             // A* with landmark (ALT) lower bounds
+    SEARCH_MODES
+} SearchMode;
+
+const char* search_mode_names[SEARCH_MODES] = {
+    "dijkstra", "heap", "bidirectional", "alt"
+};
+
+typedef struct {
+    int to;
+    int time;
+} Edge;
+
+typedef struct {
+    Edge* edges;
+    int degree;
+    int capacity;
+} AdjList;
+
+// Precomputed landmark distances for ALT searches
+typedef struct {
+    int count;
+    int* dist[ALT_LANDMARKS];   // dist[l][v] = shortest time between landmark l and v
+    int valid;
+    unsigned long version;      // Graph version the tables were built for
+} Landmarks;
+
 typedef struct {
-    char cities[MAX_CITIES][MAX_NAME];
-    int graph[MAX_CITIES][MAX_CITIES];
+    char** cities;          // City names, NULL for unnamed (synthetic) nodes
+    AdjList* adj;
     int size;
+    int capacity;
+    long edge_count;
+    unsigned long version;  // Bumped on every mutation, invalidates cached routes
+    Landmarks landmarks;
 } Graph;
 
+typedef struct {
+    int key;
+    int node;
+} HeapItem;
+
+// Reusable per-search scratch space. Stamps avoid clearing O(V) arrays per query.
+typedef struct {
+    int capacity;
+    unsigned stamp;
+    int* dist[2];           // [0] forward search, [1] backward search
+    int* parent[2];
+    unsigned* reached[2];   // reached[s][v] == stamp when dist[s][v] is valid
+    unsigned* done[2];      // done[s][v] == stamp once v is settled
+    HeapItem* heap[2];
+    int heap_size[2];
+    int heap_capacity[2];
+    long settled;           // Nodes settled by the last search
+    int out_of_memory;      // Last search gave up on an allocation; its INF is not a real answer
+} SearchContext;
+
+// Cached result of one (src, dest, mode) query
+typedef struct CacheEntry {
+    int src;
+    int dest;
+    int mode;
+    unsigned long version;
+    int cost;               // INF when no path exists
+    int* path;              // City indices from src to dest
+    int path_len;
+    struct CacheEntry* chain;   // Next entry in the same hash bucket
+    struct CacheEntry* prev;    // LRU list, towards most recently used
+    struct CacheEntry* next;    // LRU list, towards least recently used
+} CacheEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    CacheEntry* buckets[CACHE_SHARD_BUCKETS];
+    CacheEntry* head;       // Most recently used
+    CacheEntry* tail;       // Least recently used
+    int count;
+} CacheShard;
+
+// Bounded LRU cache of route queries, sharded so concurrent lookups
+// on different keys rarely contend on the same lock
+typedef struct {
+    CacheShard shards[CACHE_SHARDS];
+    atomic_ulong hits;
+    atomic_ulong misses;
+    atomic_ulong evictions;
+} RouteCache;
+
 void init_graph(Graph* g) {
+    g->cities = NULL;
+    g->adj = NULL;
     g->size = 0;
-    for (int i = 0; i < MAX_CITIES; i++) {
-        for (int j = 0; j < MAX_CITIES; j++) {
-            g->graph[i][j] = INF;
-        }
-        g->graph[i][i] = 0;
+    g->capacity = 0;
+    g->edge_count = 0;
+    g->version = 0;
+    memset(&g->landmarks, 0, sizeof(g->landmarks));
+}
+
+void free_landmarks(Landmarks* lm) {
+    for (int l = 0; l < lm->count; l++) {
+        free(lm->dist[l]);
+        lm->dist[l] = NULL;
+    }
+    lm->count = 0;
+    lm->valid = 0;
+}
+
+void free_graph(Graph* g) {
+    for (int i = 0; i < g->size; i++) {
+        free(g->cities[i]);
+        free(g->adj[i].edges);
     }
+    free(g->cities);
+    free(g->adj);
+    free_landmarks(&g->landmarks);
+    init_graph(g);
+}
+
+// Add an unnamed node, returns its index or -1 on allocation failure
+int add_node(Graph* g) {
+    if (g->size == g->capacity) {
+        int capacity = g->capacity ? g->capacity * 2 : 16;
+        char** cities = (char**)realloc(g->cities, capacity * sizeof(char*));
+        if (!cities) return -1;
+        g->cities = cities;
+        AdjList* adj = (AdjList*)realloc(g->adj, capacity * sizeof(AdjList));
+        if (!adj) return -1;
+        g->adj = adj;
+        g->capacity = capacity;
+    }
+
+    int idx = g->size++;
+    g->cities[idx] = NULL;
+    g->adj[idx].edges = NULL;
+    g->adj[idx].degree = 0;
+    g->adj[idx].capacity = 0;
+    g->version++;
+    return idx;
 }
 
 int find_city(Graph* g, const char* city) {
     for (int i = 0; i < g->size; i++) {
-        if (strcmp(g->cities[i], city) == 0) {
+        if (g->cities[i] && strcmp(g->cities[i], city) == 0) {
             return i;
         }
     }
@@ -35,25 +173,358 @@ int find_city(Graph* g, const char* city) {
 int add_city(Graph* g, const char* city) {
     int idx = find_city(g, city);
     if (idx == -1) {
-        if (g->size >= MAX_CITIES) {
-            printf("Error: Maximum number of cities reached\n");
+        idx = add_node(g);
+        if (idx == -1 || !(g->cities[idx] = strdup(city))) {
+            printf("Error: Out of memory adding city\n");
             return -1;
         }
-        strcpy(g->cities[g->size], city);
-        idx = g->size;
-        g->size++;
     }
     return idx;
 }
 
+// Append a directed edge without checking for an existing one
+int append_edge(Graph* g, int from, int to, int time) {
+    AdjList* list = &g->adj[from];
+    if (list->degree == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 4;
+        Edge* edges = (Edge*)realloc(list->edges, capacity * sizeof(Edge));
+        if (!edges) return 0;
+        list->edges = edges;
+        list->capacity = capacity;
+    }
+    list->edges[list->degree].to = to;
+    list->edges[list->degree].time = time;
+    list->degree++;
+    return 1;
+}
+
+// Return the edge from -> to, or NULL if there is none
+Edge* find_edge(Graph* g, int from, int to) {
+    AdjList* list = &g->adj[from];
+    for (int i = 0; i < list->degree; i++) {
+        if (list->edges[i].to == to) {
+            return &list->edges[i];
+        }
+    }
+    return NULL;
+}
+
+// Connect two nodes in both directions, or update the time if already connected
+void connect_nodes(Graph* g, int from, int to, int time) {
+    Edge* forward = find_edge(g, from, to);
+    if (forward) {
+        forward->time = time;
+        find_edge(g, to, from)->time = time;
+    } else if (append_edge(g, from, to, time) && append_edge(g, to, from, time)) {
+        g->edge_count++;
+    }
+    g->version++;
+}
+
 void add_route(Graph* g, const char* from, const char* to, int time) {
     int from_idx = add_city(g, from);
     int to_idx = add_city(g, to);
     
-    if (from_idx != -1 && to_idx != -1) {
-        g->graph[from_idx][to_idx] = time;
-        g->graph[to_idx][from_idx] = time;  // Undirected graph
+    if (from_idx != -1 && to_idx != -1 && from_idx != to_idx) {
+        connect_nodes(g, from_idx, to_idx, time);  // Undirected graph
+    }
+}
+
+// Drop the edge from -> to if present
+int unlink_edge(Graph* g, int from, int to) {
+    AdjList* list = &g->adj[from];
+    for (int i = 0; i < list->degree; i++) {
+        if (list->edges[i].to == to) {
+            list->edges[i] = list->edges[--list->degree];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Remove a route, returns 0 if no such route existed
+int remove_route(Graph* g, const char* from, const char* to) {
+    int from_idx = find_city(g, from);
+    int to_idx = find_city(g, to);
+
+    if (from_idx == -1 || to_idx == -1 || !unlink_edge(g, from_idx, to_idx)) {
+        return 0;
+    }
+
+    unlink_edge(g, to_idx, from_idx);
+    g->edge_count--;
+    g->version++;
+    return 1;
+}
+
+// Approximate heap footprint of the graph and its landmark tables
+size_t graph_memory(Graph* g) {
+    size_t bytes = (size_t)g->capacity * (sizeof(char*) + sizeof(AdjList));
+    for (int i = 0; i < g->size; i++) {
+        bytes += (size_t)g->adj[i].capacity * sizeof(Edge);
+        if (g->cities[i]) bytes += strlen(g->cities[i]) + 1;
     }
+    bytes += (size_t)g->landmarks.count * g->size * sizeof(int);
+    return bytes;
+}
+
+void init_cache(RouteCache* cache) {
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard* shard = &cache->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        memset(shard->buckets, 0, sizeof(shard->buckets));
+        shard->head = shard->tail = NULL;
+        shard->count = 0;
+    }
+    atomic_init(&cache->hits, 0);
+    atomic_init(&cache->misses, 0);
+    atomic_init(&cache->evictions, 0);
+}
+
+void free_cache(RouteCache* cache) {
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard* shard = &cache->shards[i];
+        CacheEntry* entry = shard->head;
+        while (entry) {
+            CacheEntry* temp = entry;
+            entry = entry->next;
+            free(temp->path);
+            free(temp);
+        }
+        pthread_mutex_destroy(&shard->lock);
+    }
+}
+
+// Mix the query key into a 64-bit hash
+uint64_t cache_hash(int src, int dest, int mode) {
+    uint64_t h = ((uint64_t)(uint32_t)src << 32) | (uint32_t)dest;
+    h ^= (uint64_t)mode * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+void lru_unlink(CacheShard* shard, CacheEntry* entry) {
+    if (entry->prev) entry->prev->next = entry->next;
+    else shard->head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else shard->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+void lru_push_front(CacheShard* shard, CacheEntry* entry) {
+    entry->prev = NULL;
+    entry->next = shard->head;
+    if (shard->head) shard->head->prev = entry;
+    shard->head = entry;
+    if (!shard->tail) shard->tail = entry;
+}
+
+// Unlink an entry from its bucket and the LRU list, then free it
+void cache_drop(CacheShard* shard, CacheEntry* entry, uint64_t hash) {
+    CacheEntry** link = &shard->buckets[(hash >> 8) % CACHE_SHARD_BUCKETS];
+    while (*link != entry) {
+        link = &(*link)->chain;
+    }
+    *link = entry->chain;
+    lru_unlink(shard, entry);
+    shard->count--;
+    free(entry->path);
+    free(entry);
+}
+
+// Look up a cached route. On a hit the path is copied into path[]
+// and the cost is returned; on a miss (or stale entry) returns -1.
+int cache_lookup(RouteCache* cache, const Graph* g, int src, int dest, int mode,
+                 int path[], int* path_len) {
+    uint64_t hash = cache_hash(src, dest, mode);
+    CacheShard* shard = &cache->shards[hash & (CACHE_SHARDS - 1)];
+    int cost = -1;
+
+    pthread_mutex_lock(&shard->lock);
+    CacheEntry* entry = shard->buckets[(hash >> 8) % CACHE_SHARD_BUCKETS];
+    while (entry && !(entry->src == src && entry->dest == dest && entry->mode == mode)) {
+        entry = entry->chain;
+    }
+
+    if (entry && entry->version != g->version) {
+        // Graph changed since this route was computed
+        cache_drop(shard, entry, hash);
+        entry = NULL;
+    }
+
+    if (entry) {
+        lru_unlink(shard, entry);
+        lru_push_front(shard, entry);
+        memcpy(path, entry->path, entry->path_len * sizeof(int));
+        *path_len = entry->path_len;
+        cost = entry->cost;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (cost == -1) atomic_fetch_add_explicit(&cache->misses, 1, memory_order_relaxed);
+    else atomic_fetch_add_explicit(&cache->hits, 1, memory_order_relaxed);
+    return cost;
+}
+
+// Store a computed route, evicting the least recently used entry if the shard is full
+void cache_store(RouteCache* cache, const Graph* g, int src, int dest, int mode,
+                 int cost, const int path[], int path_len) {
+    uint64_t hash = cache_hash(src, dest, mode);
+    CacheShard* shard = &cache->shards[hash & (CACHE_SHARDS - 1)];
+
+    CacheEntry* fresh = (CacheEntry*)malloc(sizeof(CacheEntry));
+    int* fresh_path = (int*)malloc((path_len > 0 ? path_len : 1) * sizeof(int));
+    if (!fresh || !fresh_path) {
+        free(fresh);
+        free(fresh_path);
+        return;
+    }
+    memcpy(fresh_path, path, path_len * sizeof(int));
+    fresh->src = src;
+    fresh->dest = dest;
+    fresh->mode = mode;
+    fresh->version = g->version;
+    fresh->cost = cost;
+    fresh->path = fresh_path;
+    fresh->path_len = path_len;
+
+    pthread_mutex_lock(&shard->lock);
+    CacheEntry** bucket = &shard->buckets[(hash >> 8) % CACHE_SHARD_BUCKETS];
+    CacheEntry* entry = *bucket;
+    while (entry && !(entry->src == src && entry->dest == dest && entry->mode == mode)) {
+        entry = entry->chain;
+    }
+    if (entry) {
+        cache_drop(shard, entry, hash);
+    }
+
+    while (shard->count >= CACHE_SHARD_CAPACITY && shard->tail) {
+        CacheEntry* victim = shard->tail;
+        cache_drop(shard, victim, cache_hash(victim->src, victim->dest, victim->mode));
+        atomic_fetch_add_explicit(&cache->evictions, 1, memory_order_relaxed);
+    }
+
+    fresh->chain = *bucket;
+    *bucket = fresh;
+    lru_push_front(shard, fresh);
+    shard->count++;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void print_cache_stats(RouteCache* cache) {
+    unsigned long hits = atomic_load(&cache->hits);
+    unsigned long misses = atomic_load(&cache->misses);
+    unsigned long total = hits + misses;
+    int entries = 0;
+
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        pthread_mutex_lock(&cache->shards[i].lock);
+        entries += cache->shards[i].count;
+        pthread_mutex_unlock(&cache->shards[i].lock);
+    }
+
+    printf("Route cache: %lu hits, %lu misses (%.1f%% hit rate), %lu evictions, %d entries\n",
+           hits, misses, total ? 100.0 * hits / total : 0.0,
+           atomic_load(&cache->evictions), entries);
+}
+
+void init_context(SearchContext* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void free_context(SearchContext* ctx) {
+    for (int s = 0; s < 2; s++) {
+        free(ctx->dist[s]);
+        free(ctx->parent[s]);
+        free(ctx->reached[s]);
+        free(ctx->done[s]);
+        free(ctx->heap[s]);
+    }
+    init_context(ctx);
+}
+
+// Grow scratch arrays to cover every node, returns 0 on allocation failure
+int ensure_context(SearchContext* ctx, int size) {
+    if (size <= ctx->capacity) return 1;
+
+    free_context(ctx);
+    for (int s = 0; s < 2; s++) {
+        ctx->dist[s] = (int*)malloc(size * sizeof(int));
+        ctx->parent[s] = (int*)malloc(size * sizeof(int));
+        ctx->reached[s] = (unsigned*)calloc(size, sizeof(unsigned));
+        ctx->done[s] = (unsigned*)calloc(size, sizeof(unsigned));
+        if (!ctx->dist[s] || !ctx->parent[s] || !ctx->reached[s] || !ctx->done[s]) {
+            free_context(ctx);
+            return 0;
+        }
+    }
+    ctx->capacity = size;
+    return 1;
+}
+
+size_t context_memory(SearchContext* ctx) {
+    size_t bytes = 0;
+    for (int s = 0; s < 2; s++) {
+        bytes += (size_t)ctx->capacity * (2 * sizeof(int) + 2 * sizeof(unsigned));
+        bytes += (size_t)ctx->heap_capacity[s] * sizeof(HeapItem);
+    }
+    return bytes;
+}
+
+// Start a new search: invalidate all marks from the previous one
+void begin_search(SearchContext* ctx) {
+    if (++ctx->stamp == 0) {
+        for (int s = 0; s < 2; s++) {
+            memset(ctx->reached[s], 0, ctx->capacity * sizeof(unsigned));
+            memset(ctx->done[s], 0, ctx->capacity * sizeof(unsigned));
+        }
+        ctx->stamp = 1;
+    }
+    ctx->heap_size[0] = ctx->heap_size[1] = 0;
+    ctx->settled = 0;
+}
+
+int heap_push(SearchContext* ctx, int side, int key, int node) {
+    if (ctx->heap_size[side] == ctx->heap_capacity[side]) {
+        int capacity = ctx->heap_capacity[side] ? ctx->heap_capacity[side] * 2 : 256;
+        HeapItem* heap = (HeapItem*)realloc(ctx->heap[side], capacity * sizeof(HeapItem));
+        if (!heap) {
+            ctx->out_of_memory = 1;
+            return 0;
+        }
+        ctx->heap[side] = heap;
+        ctx->heap_capacity[side] = capacity;
+    }
+
+    HeapItem* heap = ctx->heap[side];
+    int i = ctx->heap_size[side]++;
+    while (i > 0 && heap[(i - 1) / 2].key > key) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i].key = key;
+    heap[i].node = node;
+    return 1;
+}
+
+HeapItem heap_pop(SearchContext* ctx, int side) {
+    HeapItem* heap = ctx->heap[side];
+    HeapItem top = heap[0];
+    HeapItem last = heap[--ctx->heap_size[side]];
+    int size = ctx->heap_size[side];
+    int i = 0;
+
+    while (2 * i + 1 < size) {
+        int child = 2 * i + 1;
+        if (child + 1 < size && heap[child + 1].key < heap[child].key) child++;
+        if (heap[child].key >= last.key) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (size > 0) heap[i] = last;
+    return top;
 }
 
 // Find minimum distance vertex
@@ -71,37 +542,41 @@ int min_distance(int dist[], int visited[], int size) {
 }
 
 // Print path from source to destination
-void print_path(int parent[], Graph* g, int src, int dest) {
-    int path[MAX_CITIES];
-    int path_len = 0;
-    int current = dest;
-    
-    while (current != src) {
-        path[path_len++] = current;
-        current = parent[current];
-    }
-    path[path_len++] = src;
-    
+void print_path(Graph* g, int path[], int path_len) {
     printf("Shortest path: ");
-    for (int i = path_len - 1; i >= 0; i--) {
-        printf("%s", g->cities[path[i]]);
-        if (i > 0) printf(" -> ");
+    for (int i = 0; i < path_len; i++) {
+        if (g->cities[path[i]]) printf("%s", g->cities[path[i]]);
+        else printf("#%d", path[i]);
+        if (i < path_len - 1) printf(" -> ");
     }
     printf("\n");
 }
 
-void dijkstra(Graph* g, const char* start, const char* end) {
-    int src = find_city(g, start);
-    int dest = find_city(g, end);
-    
-    if (src == -1 || dest == -1) {
-        printf("Error: City not found\n");
-        return;
+// Walk parents back from dest, writing the route into path[] in src -> dest order
+void build_path(int parent[], int dest, int path[], int* path_len) {
+    *path_len = 0;
+    for (int current = dest; current != -1; current = parent[current]) {
+        path[(*path_len)++] = current;
+    }
+    for (int i = 0, j = *path_len - 1; i < j; i++, j--) {
+        int temp = path[i];
+        path[i] = path[j];
+        path[j] = temp;
+    }
+}
+
+// Reference Dijkstra: O(V^2) scan with min_distance.
+// Returns the total time, or INF if dest is unreachable.
+int shortest_path(Graph* g, SearchContext* ctx, int src, int dest, int path[], int* path_len) {
+    int* dist = ctx->dist[0];
+    int* parent = ctx->parent[0];
+    int* visited = (int*)calloc(g->size, sizeof(int));
+    if (!visited) {
+        printf("Error: Out of memory\n");
+        ctx->out_of_memory = 1;
+        *path_len = 0;
+        return INF;
     }
-    
-    int dist[MAX_CITIES];
-    int visited[MAX_CITIES] = {0};
-    int parent[MAX_CITIES];
     
     for (int i = 0; i < g->size; i++) {
         dist[i] = INF;
@@ -109,33 +584,640 @@ void dijkstra(Graph* g, const char* start, const char* end) {
     }
     
     dist[src] = 0;
+    ctx->settled = 0;
     
-    for (int count = 0; count < g->size - 1; count++) {
+    for (int count = 0; count < g->size; count++) {
         int u = min_distance(dist, visited, g->size);
         if (u == -1) break;
         
         visited[u] = 1;
+        ctx->settled++;
+        if (u == dest) break;
         
-        for (int v = 0; v < g->size; v++) {
-            if (!visited[v] && g->graph[u][v] != INF && 
-                dist[u] != INF && dist[u] + g->graph[u][v] < dist[v]) {
-                dist[v] = dist[u] + g->graph[u][v];
+        AdjList* list = &g->adj[u];
+        for (int i = 0; i < list->degree; i++) {
+            int v = list->edges[i].to;
+            if (!visited[v] && dist[u] + list->edges[i].time < dist[v]) {
+                dist[v] = dist[u] + list->edges[i].time;
                 parent[v] = u;
             }
         }
     }
     
+    free(visited);
+    *path_len = 0;
     if (dist[dest] == INF) {
+        return INF;
+    }
+    build_path(parent, dest, path, path_len);
+    return dist[dest];
+}
+
+// Binary-heap Dijkstra with lazy deletion. With dest == -1 the whole
+// graph is settled and ctx->dist[0] holds every distance from src.
+int heap_dijkstra(Graph* g, SearchContext* ctx, int src, int dest, int path[], int* path_len) {
+    int* dist = ctx->dist[0];
+    int* parent = ctx->parent[0];
+    unsigned* reached = ctx->reached[0];
+    unsigned* done = ctx->done[0];
+
+    begin_search(ctx);
+    unsigned stamp = ctx->stamp;
+    dist[src] = 0;
+    parent[src] = -1;
+    reached[src] = stamp;
+    heap_push(ctx, 0, 0, src);
+
+    while (ctx->heap_size[0] > 0) {
+        int u = heap_pop(ctx, 0).node;
+        if (done[u] == stamp) continue;
+        done[u] = stamp;
+        ctx->settled++;
+        if (u == dest) break;
+
+        AdjList* list = &g->adj[u];
+        for (int i = 0; i < list->degree; i++) {
+            int v = list->edges[i].to;
+            int nd = dist[u] + list->edges[i].time;
+            if (reached[v] != stamp || nd < dist[v]) {
+                reached[v] = stamp;
+                dist[v] = nd;
+                parent[v] = u;
+                heap_push(ctx, 0, nd, v);
+            }
+        }
+    }
+
+    *path_len = 0;
+    if (dest == -1 || done[dest] != stamp) {
+        return INF;
+    }
+    build_path(parent, dest, path, path_len);
+    return dist[dest];
+}
+
+// Bidirectional Dijkstra: expand the smaller frontier until the two
+// searches' lower bounds prove no shorter meeting point exists
+int bidirectional_dijkstra(Graph* g, SearchContext* ctx, int src, int dest,
+                           int path[], int* path_len) {
+    begin_search(ctx);
+    unsigned stamp = ctx->stamp;
+    int best = INF, meet = -1;
+
+    for (int s = 0; s < 2; s++) {
+        int origin = s == 0 ? src : dest;
+        ctx->dist[s][origin] = 0;
+        ctx->parent[s][origin] = -1;
+        ctx->reached[s][origin] = stamp;
+        heap_push(ctx, s, 0, origin);
+    }
+    if (src == dest) {
+        best = 0;
+        meet = src;
+    }
+
+    while (ctx->heap_size[0] > 0 && ctx->heap_size[1] > 0) {
+        if (best != INF && ctx->heap[0][0].key + ctx->heap[1][0].key >= best) break;
+
+        int side = ctx->heap_size[0] <= ctx->heap_size[1] ? 0 : 1;
+        int other = 1 - side;
+        int* dist = ctx->dist[side];
+        int u = heap_pop(ctx, side).node;
+        if (ctx->done[side][u] == stamp) continue;
+        ctx->done[side][u] = stamp;
+        ctx->settled++;
+
+        AdjList* list = &g->adj[u];
+        for (int i = 0; i < list->degree; i++) {
+            int v = list->edges[i].to;
+            int nd = dist[u] + list->edges[i].time;
+            if (ctx->reached[side][v] != stamp || nd < dist[v]) {
+                ctx->reached[side][v] = stamp;
+                dist[v] = nd;
+                ctx->parent[side][v] = u;
+                heap_push(ctx, side, nd, v);
+            }
+            if (ctx->reached[other][v] == stamp && dist[v] + ctx->dist[other][v] < best) {
+                best = dist[v] + ctx->dist[other][v];
+                meet = v;
+            }
+        }
+    }
+
+    *path_len = 0;
+    if (meet == -1) {
+        return INF;
+    }
+
+    // Forward half src -> meet, then follow backward parents meet -> dest
+    build_path(ctx->parent[0], meet, path, path_len);
+    for (int current = ctx->parent[1][meet]; current != -1; current = ctx->parent[1][current]) {
+        path[(*path_len)++] = current;
+    }
+    return best;
+}
+
+// Pick landmarks far apart (each maximizes its summed distance to the
+// previous ones) and store a full distance table for each
+int build_landmarks(Graph* g, SearchContext* ctx) {
+    Landmarks* lm = &g->landmarks;
+    int path_len;
+    free_landmarks(lm);
+    if (g->size == 0) return 0;
+
+    long* spread = (long*)calloc(g->size, sizeof(long));
+    if (!spread) return 0;
+
+    // Start from the node farthest from node 0
+    heap_dijkstra(g, ctx, 0, -1, NULL, &path_len);
+    int next = 0;
+    for (int v = 0; v < g->size; v++) {
+        if (ctx->reached[0][v] == ctx->stamp && ctx->dist[0][v] > ctx->dist[0][next]) next = v;
+    }
+
+    int count = g->size < ALT_LANDMARKS ? g->size : ALT_LANDMARKS;
+    for (int l = 0; l < count; l++) {
+        int* table = (int*)malloc(g->size * sizeof(int));
+        if (!table) break;
+        lm->dist[lm->count++] = table;
+
+        heap_dijkstra(g, ctx, next, -1, NULL, &path_len);
+        spread[next] = -1;
+        int farthest = -1;
+        for (int v = 0; v < g->size; v++) {
+            table[v] = ctx->reached[0][v] == ctx->stamp ? ctx->dist[0][v] : INF;
+            if (spread[v] < 0) continue;
+            if (table[v] != INF) spread[v] += table[v];
+            if (farthest == -1 || spread[v] > spread[farthest]) farthest = v;
+        }
+        if (farthest == -1) break;
+        next = farthest;
+    }
+
+    free(spread);
+    lm->valid = 1;
+    lm->version = g->version;
+    return lm->count;
+}
+
+// Lower bound on the time from v to dest by the triangle inequality
+int landmark_bound(Landmarks* lm, int v, int dest) {
+    int bound = 0;
+    for (int l = 0; l < lm->count; l++) {
+        int dv = lm->dist[l][v];
+        int dt = lm->dist[l][dest];
+        if (dv == INF || dt == INF) continue;
+        int diff = dv > dt ? dv - dt : dt - dv;
+        if (diff > bound) bound = diff;
+    }
+    return bound;
+}
+
+// A* search guided by landmark lower bounds (ALT). Rebuilds the landmark
+// tables first if the graph changed since they were computed.
+int alt_search(Graph* g, SearchContext* ctx, int src, int dest, int path[], int* path_len) {
+    Landmarks* lm = &g->landmarks;
+    if (!lm->valid || lm->version != g->version) {
+        build_landmarks(g, ctx);
+    }
+
+    int* dist = ctx->dist[0];
+    int* parent = ctx->parent[0];
+    unsigned* reached = ctx->reached[0];
+    unsigned* done = ctx->done[0];
+
+    begin_search(ctx);
+    unsigned stamp = ctx->stamp;
+    dist[src] = 0;
+    parent[src] = -1;
+    reached[src] = stamp;
+    heap_push(ctx, 0, landmark_bound(lm, src, dest), src);
+
+    while (ctx->heap_size[0] > 0) {
+        int u = heap_pop(ctx, 0).node;
+        if (done[u] == stamp) continue;
+        done[u] = stamp;
+        ctx->settled++;
+        if (u == dest) break;
+
+        AdjList* list = &g->adj[u];
+        for (int i = 0; i < list->degree; i++) {
+            int v = list->edges[i].to;
+            int nd = dist[u] + list->edges[i].time;
+            if (reached[v] != stamp || nd < dist[v]) {
+                reached[v] = stamp;
+                dist[v] = nd;
+                parent[v] = u;
+                heap_push(ctx, 0, nd + landmark_bound(lm, v, dest), v);
+            }
+        }
+    }
+
+    *path_len = 0;
+    if (done[dest] != stamp) {
+        return INF;
+    }
+    build_path(parent, dest, path, path_len);
+    return dist[dest];
+}
+
+// Run one search in the given mode, bypassing the cache
+int run_search(Graph* g, SearchContext* ctx, int src, int dest, SearchMode mode,
+               int path[], int* path_len) {
+    ctx->out_of_memory = 0;
+    if (!ensure_context(ctx, g->size)) {
+        printf("Error: Out of memory\n");
+        ctx->out_of_memory = 1;
+        *path_len = 0;
+        return INF;
+    }
+
+    switch (mode) {
+        case SEARCH_HEAP:
+            return heap_dijkstra(g, ctx, src, dest, path, path_len);
+        case SEARCH_BIDIRECTIONAL:
+            return bidirectional_dijkstra(g, ctx, src, dest, path, path_len);
+        case SEARCH_ALT:
+            return alt_search(g, ctx, src, dest, path, path_len);
+        default:
+            return shortest_path(g, ctx, src, dest, path, path_len);
+    }
+}
+
+// Answer a route query, from the cache when the graph has not changed
+int find_route(Graph* g, RouteCache* cache, SearchContext* ctx, int src, int dest,
+               SearchMode mode, int path[], int* path_len) {
+    int cost = cache_lookup(cache, g, src, dest, mode, path, path_len);
+    if (cost != -1) {
+        ctx->settled = 0;
+        return cost;
+    }
+
+    cost = run_search(g, ctx, src, dest, mode, path, path_len);
+    if (!ctx->out_of_memory) cache_store(cache, g, src, dest, mode, cost, path, *path_len);
+    return cost;
+}
+
+void dijkstra(Graph* g, RouteCache* cache, SearchContext* ctx, const char* start, const char* end) {
+    int src = find_city(g, start);
+    int dest = find_city(g, end);
+    
+    if (src == -1 || dest == -1) {
+        printf("Error: City not found\n");
+        return;
+    }
+    
+    int* path = (int*)malloc(g->size * sizeof(int));
+    if (!path) {
+        printf("Error: Out of memory\n");
+        return;
+    }
+    int path_len;
+    int cost = find_route(g, cache, ctx, src, dest, SEARCH_DIJKSTRA, path, &path_len);
+    
+    if (cost == INF) {
         printf("No path exists between %s and %s\n", start, end);
     } else {
-        print_path(parent, g, src, dest);
-        printf("Total time: %d minutes\n", dist[dest]);
+        print_path(g, path, path_len);
+        printf("Total time: %d minutes\n", cost);
+    }
+    free(path);
+}
+
+// ---- Benchmark harness ----
+
+#define BENCH_DEFAULT_MAX_NODES 1000000
+#define BENCH_DEFAULT_QUERIES 200
+#define BENCH_REFERENCE_MAX_NODES 1000  // Largest graph checked against the O(V^2) reference
+#define BENCH_AVG_DEGREE 8              // Target degree for random geometric graphs
+#define BENCH_SCALE_FREE_LINKS 3        // Edges added per node in scale-free graphs
+
+typedef enum {
+    GRAPH_GRID = 0,
+    GRAPH_GEOMETRIC,
+    GRAPH_SCALE_FREE,
+    GRAPH_KINDS
+} GraphKind;
+
+const char* graph_kind_names[GRAPH_KINDS] = { "grid", "geometric", "scale-free" };
+
+uint64_t bench_seed = 0x2545F4914F6CDD1DULL;
+
+// xorshift64* generator, deterministic across runs
+uint64_t bench_rand() {
+    bench_seed ^= bench_seed >> 12;
+    bench_seed ^= bench_seed << 25;
+    bench_seed ^= bench_seed >> 27;
+    return bench_seed * 0x2545F4914F6CDD1DULL;
+}
+
+double bench_uniform() {
+    return (bench_rand() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+int add_nodes(Graph* g, int count) {
+    for (int i = 0; i < count; i++) {
+        if (add_node(g) == -1) return 0;
     }
+    return 1;
 }
 
-int main() {
+// Generators know their edges are unique, so they skip connect_nodes' duplicate check
+void link_nodes(Graph* g, int u, int v, int time) {
+    if (append_edge(g, u, v, time) && append_edge(g, v, u, time)) {
+        g->edge_count++;
+    }
+}
+
+// side x side lattice with 4-neighbour links and random times
+int generate_grid(Graph* g, int nodes) {
+    int side = 1;
+    while ((long)(side + 1) * (side + 1) <= nodes) side++;
+    if (!add_nodes(g, side * side)) return 0;
+
+    for (int r = 0; r < side; r++) {
+        for (int c = 0; c < side; c++) {
+            int u = r * side + c;
+            if (c + 1 < side) link_nodes(g, u, u + 1, 1 + bench_rand() % 100);
+            if (r + 1 < side) link_nodes(g, u, u + side, 1 + bench_rand() % 100);
+        }
+    }
+    return 1;
+}
+
+// Points in the unit square, linked when closer than a radius chosen for
+// BENCH_AVG_DEGREE expected neighbours. A cell grid keeps generation O(n).
+int generate_geometric(Graph* g, int nodes) {
+    double radius = sqrt(BENCH_AVG_DEGREE / (3.14159265358979 * nodes));
+    int cells = (int)(1.0 / radius);
+    if (cells < 1) cells = 1;
+
+    double* x = (double*)malloc(nodes * sizeof(double));
+    double* y = (double*)malloc(nodes * sizeof(double));
+    int* cell_start = (int*)calloc((size_t)cells * cells + 1, sizeof(int));
+    int* order = (int*)malloc(nodes * sizeof(int));
+    int ok = x && y && cell_start && order && add_nodes(g, nodes);
+
+    if (ok) {
+        // Counting sort of points by cell
+        for (int i = 0; i < nodes; i++) {
+            x[i] = bench_uniform();
+            y[i] = bench_uniform();
+            int cx = (int)(x[i] * cells), cy = (int)(y[i] * cells);
+            cell_start[cy * cells + cx + 1]++;
+        }
+        for (int c = 0; c < cells * cells; c++) cell_start[c + 1] += cell_start[c];
+        int* fill = (int*)malloc((size_t)cells * cells * sizeof(int));
+        ok = fill != NULL;
+        if (ok) {
+            memcpy(fill, cell_start, (size_t)cells * cells * sizeof(int));
+            for (int i = 0; i < nodes; i++) {
+                int cx = (int)(x[i] * cells), cy = (int)(y[i] * cells);
+                order[fill[cy * cells + cx]++] = i;
+            }
+            free(fill);
+        }
+    }
+
+    for (int i = 0; ok && i < nodes; i++) {
+        int cx = (int)(x[i] * cells), cy = (int)(y[i] * cells);
+        for (int ny = cy - 1; ny <= cy + 1; ny++) {
+            for (int nx = cx - 1; nx <= cx + 1; nx++) {
+                if (nx < 0 || ny < 0 || nx >= cells || ny >= cells) continue;
+                int cell = ny * cells + nx;
+                for (int k = cell_start[cell]; k < cell_start[cell + 1]; k++) {
+                    int j = order[k];
+                    if (j <= i) continue;
+                    double dx = x[i] - x[j], dy = y[i] - y[j];
+                    double d = sqrt(dx * dx + dy * dy);
+                    if (d < radius) link_nodes(g, i, j, 1 + (int)(d * 10000));
+                }
+            }
+        }
+    }
+
+    free(x);
+    free(y);
+    free(cell_start);
+    free(order);
+    return ok;
+}
+
+// Barabasi-Albert preferential attachment: each new node links to
+// BENCH_SCALE_FREE_LINKS existing nodes chosen proportionally to degree
+int generate_scale_free(Graph* g, int nodes) {
+    int m = BENCH_SCALE_FREE_LINKS;
+    if (nodes <= m) return generate_grid(g, nodes);
+
+    // Every edge endpoint appears once, so a uniform pick is degree-weighted
+    int* endpoints = (int*)malloc((size_t)2 * m * nodes * sizeof(int));
+    if (!endpoints || !add_nodes(g, nodes)) {
+        free(endpoints);
+        return 0;
+    }
+    long count = 0;
+
+    for (int u = 0; u <= m; u++) {
+        for (int v = u + 1; v <= m; v++) {
+            link_nodes(g, u, v, 1 + bench_rand() % 100);
+            endpoints[count++] = u;
+            endpoints[count++] = v;
+        }
+    }
+
+    for (int u = m + 1; u < nodes; u++) {
+        int targets[BENCH_SCALE_FREE_LINKS];
+        for (int k = 0; k < m; k++) {
+            int t, dup;
+            do {
+                t = endpoints[bench_rand() % count];
+                dup = 0;
+                for (int j = 0; j < k; j++) dup |= targets[j] == t;
+            } while (dup);
+            targets[k] = t;
+        }
+        for (int k = 0; k < m; k++) {
+            link_nodes(g, u, targets[k], 1 + bench_rand() % 100);
+            endpoints[count++] = u;
+            endpoints[count++] = targets[k];
+        }
+    }
+
+    free(endpoints);
+    return 1;
+}
+
+int generate_graph(Graph* g, GraphKind kind, int nodes) {
+    switch (kind) {
+        case GRAPH_GRID: return generate_grid(g, nodes);
+        case GRAPH_GEOMETRIC: return generate_geometric(g, nodes);
+        default: return generate_scale_free(g, nodes);
+    }
+}
+
+int compare_long(const void* a, const void* b) {
+    long x = *(const long*)a, y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+// Check that a returned path is connected, starts and ends correctly and sums to cost
+int valid_path(Graph* g, int src, int dest, int cost, int path[], int path_len) {
+    if (cost == INF) return path_len == 0;
+    if (path_len == 0 || path[0] != src || path[path_len - 1] != dest) return 0;
+
+    long total = 0;
+    for (int i = 0; i + 1 < path_len; i++) {
+        Edge* e = find_edge(g, path[i], path[i + 1]);
+        if (!e) return 0;
+        total += e->time;
+    }
+    return total == cost;
+}
+
+// Benchmark every search mode on one generated graph, returns mismatches found
+long bench_graph(GraphKind kind, int nodes, int queries) {
+    Graph g;
+    SearchContext ctx;
+    RouteCache cache;
+    init_graph(&g);
+    init_context(&ctx);
+    init_cache(&cache);
+
+    double start = now_ms();
+    if (!generate_graph(&g, kind, nodes) || !ensure_context(&ctx, g.size)) {
+        printf("%-10s %9d  generation failed (out of memory)\n", graph_kind_names[kind], nodes);
+        free_graph(&g);
+        free_context(&ctx);
+        free_cache(&cache);
+        return 0;
+    }
+    double build_ms = now_ms() - start;
+
+    start = now_ms();
+    build_landmarks(&g, &ctx);
+    double preprocess_ms = now_ms() - start;
+    double memory_mb = (graph_memory(&g) + context_memory(&ctx)) / (1024.0 * 1024.0);
+
+    int* sources = (int*)malloc(queries * sizeof(int));
+    int* targets = (int*)malloc(queries * sizeof(int));
+    int* expected = (int*)malloc(queries * sizeof(int));
+    long* latency = (long*)malloc(queries * sizeof(long));
+    int* path = (int*)malloc(g.size * sizeof(int));
+    long mismatches = 0;
+    if (!sources || !targets || !expected || !latency || !path) {
+        printf("Error: Out of memory\n");
+        queries = 0;
+    }
+    for (int q = 0; q < queries; q++) {
+        sources[q] = bench_rand() % g.size;
+        targets[q] = bench_rand() % g.size;
+    }
+
+    printf("%-10s %9d nodes %10ld edges  build %9.1f ms  preprocess %9.1f ms  memory %8.1f MB\n",
+           graph_kind_names[kind], g.size, g.edge_count, build_ms, preprocess_ms, memory_mb);
+
+    // Reference answers: the O(V^2) Dijkstra on small graphs, heap Dijkstra beyond that
+    SearchMode reference = g.size <= BENCH_REFERENCE_MAX_NODES ? SEARCH_DIJKSTRA : SEARCH_HEAP;
+    int path_len;
+    for (int q = 0; q < queries; q++) {
+        expected[q] = run_search(&g, &ctx, sources[q], targets[q], reference, path, &path_len);
+    }
+
+    for (int mode = 0; mode < SEARCH_MODES; mode++) {
+        if (mode == SEARCH_DIJKSTRA && g.size > BENCH_REFERENCE_MAX_NODES) continue;
+
+        long settled = 0, errors = 0;
+        for (int q = 0; q < queries; q++) {
+            long t0 = now_ns();
+            int cost = run_search(&g, &ctx, sources[q], targets[q], mode, path, &path_len);
+            latency[q] = now_ns() - t0;
+            settled += ctx.settled;
+            if (cost != expected[q] || !valid_path(&g, sources[q], targets[q], cost, path, path_len)) {
+                errors++;
+            }
+        }
+        qsort(latency, queries, sizeof(long), compare_long);
+        printf("    %-14s p50 %10.1f us  p99 %10.1f us  settled %11.1f  mismatches %ld\n",
+               search_mode_names[mode],
+               queries ? latency[queries / 2] / 1e3 : 0.0,
+               queries ? latency[(int)(queries * 0.99)] / 1e3 : 0.0,
+               queries ? (double)settled / queries : 0.0, errors);
+        mismatches += errors;
+    }
+
+    // Repeat the workload through the route cache: the second pass is all hits
+    for (int pass = 0; pass < 2; pass++) {
+        for (int q = 0; q < queries; q++) {
+            long t0 = now_ns();
+            find_route(&g, &cache, &ctx, sources[q], targets[q], SEARCH_BIDIRECTIONAL, path, &path_len);
+            latency[q] = now_ns() - t0;
+        }
+    }
+    qsort(latency, queries, sizeof(long), compare_long);
+    printf("    %-14s p50 %10.1f us  p99 %10.1f us\n", "cached",
+           queries ? latency[queries / 2] / 1e3 : 0.0,
+           queries ? latency[(int)(queries * 0.99)] / 1e3 : 0.0);
+
+    free(sources);
+    free(targets);
+    free(expected);
+    free(latency);
+    free(path);
+    free_graph(&g);
+    free_context(&ctx);
+    free_cache(&cache);
+    return mismatches;
+}
+
+// Run the benchmark on every graph kind from 1k nodes up to max_nodes.
+// Returns 1 if any optimized mode disagreed with the reference.
+int run_benchmark(long max_nodes, int queries) {
+    long mismatches = 0;
+
+    printf("Routing benchmark: %d random queries per graph, up to %ld nodes\n", queries, max_nodes);
+    for (long nodes = 1000; nodes <= max_nodes; nodes *= 10) {
+        for (int kind = 0; kind < GRAPH_KINDS; kind++) {
+            mismatches += bench_graph(kind, (int)nodes, queries);
+        }
+    }
+
+    if (mismatches) {
+        printf("FAILED: %ld results differ from the reference Dijkstra\n", mismatches);
+        return 1;
+    }
+    printf("All search modes match the reference Dijkstra\n");
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        long max_nodes = argc > 2 ? atol(argv[2]) : BENCH_DEFAULT_MAX_NODES;
+        int queries = argc > 3 ? atoi(argv[3]) : BENCH_DEFAULT_QUERIES;
+        if (max_nodes < 1000 || max_nodes > INT_MAX || queries < 1) {
+            printf("Usage: %s --bench [max_nodes >= 1000] [queries >= 1]\n", argv[0]);
+            return 1;
+        }
+        return run_benchmark(max_nodes, queries);
+    }
+
     Graph g;
+    RouteCache cache;
+    SearchContext ctx;
     init_graph(&g);
+    init_cache(&cache);
+    init_context(&ctx);
     
     // Add given routes
     add_route(&g, "Bumbogo", "Nayinzira", 10);
@@ -150,16 +1232,23 @@ int main() {
     char start[MAX_NAME], end[MAX_NAME];
     
     while (1) {
-        printf("\nEnter starting city (or 'quit' to exit): ");
-        scanf("%s", start);
+        printf("\nEnter starting city ('stats' for cache stats, 'quit' to exit): ");
+        if (scanf("%49s", start) != 1) break;
         
         if (strcmp(start, "quit") == 0) break;
+        if (strcmp(start, "stats") == 0) {
+            print_cache_stats(&cache);
+            continue;
+        }
         
         printf("Enter destination city: ");
-        scanf("%s", end);
+        if (scanf("%49s", end) != 1) break;
         
-        dijkstra(&g, start, end);
+        dijkstra(&g, &cache, &ctx, start, end);
     }
     
+    free_cache(&cache);
+    free_context(&ctx);
+    free_graph(&g);
     return 0;
-}
\ No newline at end of file
+}